@@ -0,0 +1,226 @@
+/* Gemini Browser - In-memory response cache */
+#include "cache.h"
+#include "disk_cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+typedef struct {
+    char key[MAX_URL_LENGTH];
+    GeminiResponse *resp;
+    Uint32 stored_at;           /* SDL_GetTicks() of the last store */
+    unsigned long last_used;    /* LRU clock value */
+} CacheEntry;
+
+static CacheEntry entries[CACHE_MAX_ENTRIES];
+static int num_entries = 0;
+static unsigned long lru_clock = 0;
+static size_t total_bytes = 0;
+static size_t max_bytes = CACHE_MAX_BYTES;
+static Uint32 fresh_ms = CACHE_FRESH_MS;
+static CacheStats stats;
+
+/* url->full is already lowercased in the host and dot-segment free; the
+ * scheme may still vary in case and a fragment is never sent */
+static void make_key(char *key, const Url *url) {
+    strncpy(key, url->full, MAX_URL_LENGTH - 1);
+    key[MAX_URL_LENGTH - 1] = '\0';
+
+    char *sep = strstr(key, "://");
+    for (char *c = key; c < sep; c++) {
+        *c = tolower((unsigned char)*c);
+    }
+
+    char *fragment = strchr(key, '#');
+    if (fragment) *fragment = '\0';
+}
+
+static int find_entry(const char *key) {
+    for (int i = 0; i < num_entries; i++) {
+        if (strcmp(entries[i].key, key) == 0) return i;
+    }
+    return -1;
+}
+
+static void remove_entry(int index) {
+    total_bytes -= entries[index].resp->body_len;
+    gemini_response_free(entries[index].resp);
+    entries[index] = entries[num_entries - 1];
+    num_entries--;
+}
+
+static void evict_lru(void) {
+    int index = 0;
+    for (int i = 1; i < num_entries; i++) {
+        if (entries[i].last_used < entries[index].last_used) index = i;
+    }
+    remove_entry(index);
+    stats.evictions++;
+}
+
+static GeminiResponse *copy_response(const GeminiResponse *resp) {
+    GeminiResponse *copy = malloc(sizeof(GeminiResponse));
+    if (!copy) return NULL;
+
+    memcpy(copy, resp, sizeof(GeminiResponse));
+    copy->body = NULL;
+    copy->body_base = NULL;
+    if (resp->body) {
+        /* Keep the terminator callers of gemini_fetch() rely on */
+        copy->body = malloc(resp->body_len + 1);
+        if (!copy->body) {
+            free(copy);
+            return NULL;
+        }
+        memcpy(copy->body, resp->body, resp->body_len);
+        copy->body[resp->body_len] = '\0';
+    }
+    return copy;
+}
+
+static CacheLookup entry_state(const CacheEntry *e) {
+    return SDL_GetTicks() - e->stored_at < fresh_ms ? CACHE_FRESH : CACHE_STALE;
+}
+
+/* Add a response to memory, taking ownership of it */
+static CacheEntry *insert_entry(const char *key, GeminiResponse *resp, Uint32 stored_at) {
+    while (num_entries > 0 &&
+           (num_entries >= CACHE_MAX_ENTRIES || total_bytes + resp->body_len > max_bytes)) {
+        evict_lru();
+    }
+
+    CacheEntry *e = &entries[num_entries++];
+    memcpy(e->key, key, sizeof(e->key));
+    e->resp = resp;
+    e->stored_at = stored_at;
+    e->last_used = ++lru_clock;
+    total_bytes += resp->body_len;
+    return e;
+}
+
+/* Bring key in from the disk cache, dating it by its age there */
+static int load_from_disk(const char *key) {
+    GeminiResponse *resp;
+    long age_sec;
+    if (!disk_cache_get(key, &resp, &age_sec)) return -1;
+
+    if (resp->body_len > max_bytes / 4) {
+        gemini_response_free(resp);
+        return -1;
+    }
+
+    /* Anything past the freshness window is just stale */
+    Uint32 age_ms = fresh_ms;
+    if (age_sec < (long)(fresh_ms / 1000)) age_ms = age_sec > 0 ? (Uint32)age_sec * 1000 : 0;
+    insert_entry(key, resp, SDL_GetTicks() - age_ms);
+    stats.disk_hits++;
+    return num_entries - 1;
+}
+
+void cache_init(size_t max, Uint32 fresh) {
+    cache_cleanup();
+    max_bytes = max;
+    fresh_ms = fresh;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void cache_cleanup(void) {
+    while (num_entries > 0) {
+        remove_entry(num_entries - 1);
+    }
+}
+
+CacheLookup cache_get(const Url *url, GeminiResponse **out) {
+    if (!url || !out) return CACHE_MISS;
+    *out = NULL;
+
+    char key[MAX_URL_LENGTH];
+    make_key(key, url);
+
+    stats.lookups++;
+    int index = find_entry(key);
+    if (index < 0) index = load_from_disk(key);
+    if (index < 0) return CACHE_MISS;
+
+    *out = copy_response(entries[index].resp);
+    if (!*out) return CACHE_MISS;
+
+    entries[index].last_used = ++lru_clock;
+    CacheLookup state = entry_state(&entries[index]);
+    if (state == CACHE_FRESH) {
+        stats.fresh_hits++;
+    }
+    else {
+        stats.stale_hits++;
+    }
+    return state;
+}
+
+CacheLookup cache_peek(const Url *url) {
+    if (!url) return CACHE_MISS;
+
+    char key[MAX_URL_LENGTH];
+    make_key(key, url);
+
+    int index = find_entry(key);
+    if (index >= 0) return entry_state(&entries[index]);
+
+    long age_sec = disk_cache_age(key);
+    if (age_sec < 0) return CACHE_MISS;
+    return age_sec < (long)(fresh_ms / 1000) ? CACHE_FRESH : CACHE_STALE;
+}
+
+bool cache_put(const Url *url, const GeminiResponse *resp) {
+    if (!url || !resp) return false;
+
+    /* Partial bodies and anything but a page aren't worth repeating */
+    if (gemini_status_category(resp->status) != 2 || resp->truncated) return false;
+
+    char key[MAX_URL_LENGTH];
+    make_key(key, url);
+    int index = find_entry(key);
+
+    /* One page may not push out most of the others */
+    if (resp->body_len > max_bytes / 4) {
+        if (index >= 0) remove_entry(index);
+        disk_cache_remove(key);
+        return true;
+    }
+
+    bool changed = true;
+    if (index >= 0) {
+        const GeminiResponse *old = entries[index].resp;
+        changed = old->body_len != resp->body_len || strcmp(old->meta, resp->meta) != 0 ||
+                  (resp->body_len && memcmp(old->body, resp->body, resp->body_len) != 0);
+        stats.refreshed++;
+        if (changed) stats.changed++;
+
+        if (!changed) {
+            /* Same content - just restart the freshness window */
+            entries[index].stored_at = SDL_GetTicks();
+            entries[index].last_used = ++lru_clock;
+            disk_cache_touch(key);
+            return false;
+        }
+        remove_entry(index);
+    }
+
+    /* Write through, so the page survives the app being killed */
+    disk_cache_put(key, resp);
+
+    GeminiResponse *copy = copy_response(resp);
+    if (!copy) return changed;
+
+    insert_entry(key, copy, SDL_GetTicks());
+    stats.stores++;
+    return changed;
+}
+
+void cache_stats(CacheStats *out) {
+    if (!out) return;
+
+    *out = stats;
+    out->entries = num_entries;
+    out->bytes = total_bytes;
+    out->max_bytes = max_bytes;
+}
@@ -0,0 +1,58 @@
+/* Gemini Browser - In-memory response cache */
+#ifndef PALMINI_CACHE_H
+#define PALMINI_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <SDL.h>
+#include "gemini.h"
+#include "url.h"
+
+#define CACHE_MAX_ENTRIES   64
+#define CACHE_MAX_BYTES     (2 * 1024 * 1024)   /* Bodies in total */
+#define CACHE_FRESH_MS      (5 * 60 * 1000)     /* Served without revalidating */
+
+typedef enum {
+    CACHE_MISS,
+    CACHE_FRESH,        /* Within the freshness window */
+    CACHE_STALE         /* Older - show it, but fetch a new copy */
+} CacheLookup;
+
+typedef struct {
+    unsigned long lookups;
+    unsigned long fresh_hits;
+    unsigned long stale_hits;
+    unsigned long disk_hits;    /* Hits (fresh or stale) loaded from the disk cache */
+    unsigned long stores;
+    unsigned long evictions;
+    unsigned long refreshed;    /* Stale entries replaced by a new copy */
+    unsigned long changed;      /* ...whose content differed */
+    int entries;
+    size_t bytes;
+    size_t max_bytes;
+} CacheStats;
+
+/* The cache is only used from the UI thread. Misses fall through to the
+ * disk cache, and stores are written through to it. */
+
+/* Set the size limit and freshness window. Drops existing entries. */
+void cache_init(size_t max_bytes, Uint32 fresh_ms);
+
+/* Free all entries */
+void cache_cleanup(void);
+
+/* Look up url. On a hit, *out receives a copy of the response that the
+ * caller frees with gemini_response_free(). */
+CacheLookup cache_get(const Url *url, GeminiResponse **out);
+
+/* Like cache_get() without copying or counting a lookup */
+CacheLookup cache_peek(const Url *url);
+
+/* Store a copy of a successful response. Anything else is ignored.
+ * Returns true if the content differs from what was cached before. */
+bool cache_put(const Url *url, const GeminiResponse *resp);
+
+/* Get a snapshot of the counters */
+void cache_stats(CacheStats *stats);
+
+#endif /* PALMINI_CACHE_H */
@@ -0,0 +1,242 @@
+/* Gemini Browser - Happy Eyeballs (RFC 8305) connection racing */
+#define _GNU_SOURCE
+#include "connect.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* TCP_FASTOPEN_CONNECT needs Linux 4.11 and TCPI_OPT_SYN_DATA 3.7. Older
+ * headers lack them; older kernels reject the option. */
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#ifndef TCPI_OPT_SYN_DATA
+#define TCPI_OPT_SYN_DATA 32
+#endif
+
+/* Only the fetch engine thread runs races. The debug screen's snapshot
+ * may be a count behind, which is all it needs. */
+static ConnectStats stats;
+
+static void set_port(struct sockaddr_storage *addr, uint16_t port) {
+    if (addr->ss_family == AF_INET) {
+        ((struct sockaddr_in *)addr)->sin_port = htons(port);
+    }
+    else if (addr->ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+    }
+}
+
+static void append_addr(ResolvedAddrs *out, const ResolvedAddrs *in, int index) {
+    memcpy(&out->addrs[out->count], &in->addrs[index], sizeof(struct sockaddr_storage));
+    out->addr_lens[out->count] = in->addr_lens[index];
+    out->count++;
+}
+
+/* Interleave address families, starting with the preferred one */
+static void order_addrs(ResolvedAddrs *out, const ResolvedAddrs *in, int preferred_family) {
+    int primary[RESOLVER_MAX_ADDRS], secondary[RESOLVER_MAX_ADDRS];
+    int num_primary = 0, num_secondary = 0;
+
+    /* Without a remembered preference, trust getaddrinfo's ordering */
+    if (preferred_family == AF_UNSPEC && in->count > 0) {
+        preferred_family = in->addrs[0].ss_family;
+    }
+
+    for (int i = 0; i < in->count; i++) {
+        if (in->addrs[i].ss_family == preferred_family) {
+            primary[num_primary++] = i;
+        }
+        else {
+            secondary[num_secondary++] = i;
+        }
+    }
+
+    out->count = 0;
+    out->preferred_family = preferred_family;
+    int p = 0, s = 0;
+    while (p < num_primary || s < num_secondary) {
+        if (p < num_primary) append_addr(out, in, primary[p++]);
+        if (s < num_secondary) append_addr(out, in, secondary[s++]);
+    }
+}
+
+static void close_others(ConnectRace *race, int keep_index) {
+    for (int i = 0; i < race->addrs.count; i++) {
+        if (i != keep_index && race->socks[i] >= 0) {
+            close(race->socks[i]);
+            race->socks[i] = -1;
+        }
+    }
+}
+
+static void declare_winner(ConnectRace *race, int index) {
+    race->winner = race->socks[index];
+    race->winner_index = index;
+    race->socks[index] = -1;
+    close_others(race, -1);
+
+    stats.races++;
+    if (index == 0) {
+        stats.won_first++;
+    }
+    else {
+        stats.won_fallback++;
+    }
+    if (race->addrs.addrs[index].ss_family == AF_INET6) {
+        stats.ipv6_wins++;
+    }
+    else {
+        stats.ipv4_wins++;
+    }
+}
+
+/* Start the next address. Addresses that fail synchronously are skipped. */
+static void start_attempt(ConnectRace *race) {
+    while (race->next < race->addrs.count && race->winner < 0) {
+        int i = race->next++;
+        struct sockaddr_storage *addr = &race->addrs.addrs[i];
+
+        int sock = socket(addr->ss_family, SOCK_STREAM, 0);
+        if (sock < 0) continue;
+
+        int flags = fcntl(sock, F_GETFL, 0);
+        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+        if (race->fast_open) {
+            int one = 1;
+            if (setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one)) == 0) {
+                stats.fast_open_tries++;
+            }
+            else {
+                /* Don't ask again on a kernel without it */
+                stats.fast_open_unsupported = true;
+                race->fast_open = false;
+            }
+        }
+
+        int ret = connect(sock, (struct sockaddr *)addr, race->addrs.addr_lens[i]);
+        if (ret == 0) {
+            /* A Fast Open connect only completes at once when the SYN was
+             * deferred to carry the first write */
+            if (race->fast_open) {
+                race->deferred = true;
+                stats.fast_open_deferred++;
+            }
+            race->socks[i] = sock;
+            declare_winner(race, i);
+            return;
+        }
+        if (errno != EINPROGRESS) {
+            close(sock);
+            continue;
+        }
+
+        race->socks[i] = sock;
+        race->next_attempt_at = SDL_GetTicks() + CONNECT_ATTEMPT_DELAY_MS;
+        return;
+    }
+}
+
+void connect_race_start(ConnectRace *race, const ResolvedAddrs *addrs, uint16_t port,
+                        bool fast_open) {
+    order_addrs(&race->addrs, addrs, addrs->preferred_family);
+    for (int i = 0; i < race->addrs.count; i++) {
+        set_port(&race->addrs.addrs[i], port);
+        race->socks[i] = -1;
+    }
+    race->next = 0;
+    race->winner = -1;
+    race->winner_index = -1;
+    race->fast_open = fast_open && !stats.fast_open_unsupported;
+    race->deferred = false;
+
+    start_attempt(race);
+}
+
+int connect_race_pollfds(const ConnectRace *race, struct pollfd *fds, int max_fds) {
+    int n = 0;
+    for (int i = 0; i < race->addrs.count && n < max_fds; i++) {
+        if (race->socks[i] >= 0) {
+            fds[n].fd = race->socks[i];
+            fds[n].events = POLLOUT;
+            fds[n].revents = 0;
+            n++;
+        }
+    }
+    return n;
+}
+
+int connect_race_timeout(const ConnectRace *race) {
+    if (race->winner >= 0 || race->next >= race->addrs.count) return -1;
+
+    Sint32 remaining = (Sint32)(race->next_attempt_at - SDL_GetTicks());
+    return remaining > 0 ? remaining : 0;
+}
+
+int connect_race_step(ConnectRace *race, const struct pollfd *fds, int nfds) {
+    if (race->winner >= 0) return race->winner;
+
+    bool attempt_failed = false;
+    for (int f = 0; f < nfds; f++) {
+        if (!fds[f].revents) continue;
+
+        for (int i = 0; i < race->addrs.count; i++) {
+            if (race->socks[i] != fds[f].fd) continue;
+
+            int error = 0;
+            socklen_t len = sizeof(error);
+            if (getsockopt(race->socks[i], SOL_SOCKET, SO_ERROR, &error, &len) == 0 && !error) {
+                declare_winner(race, i);
+                return race->winner;
+            }
+
+            close(race->socks[i]);
+            race->socks[i] = -1;
+            attempt_failed = true;
+            break;
+        }
+    }
+
+    /* A failure starts the next attempt right away instead of waiting out
+     * the delay */
+    if (attempt_failed || connect_race_timeout(race) == 0) {
+        start_attempt(race);
+        if (race->winner >= 0) return race->winner;
+    }
+
+    for (int i = 0; i < race->addrs.count; i++) {
+        if (race->socks[i] >= 0) return -1;
+    }
+    if (race->next < race->addrs.count) return -1;
+
+    stats.races++;
+    stats.failed++;
+    return -2;
+}
+
+int connect_race_family(const ConnectRace *race) {
+    if (race->winner_index < 0) return AF_UNSPEC;
+    return race->addrs.addrs[race->winner_index].ss_family;
+}
+
+bool connect_syn_data_acked(int sock) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) return false;
+    return (info.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+}
+
+void connect_race_abort(ConnectRace *race) {
+    close_others(race, -1);
+    race->next = race->addrs.count;
+}
+
+void connect_stats(ConnectStats *out) {
+    if (!out) return;
+    memcpy(out, &stats, sizeof(*out));
+}
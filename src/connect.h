@@ -0,0 +1,71 @@
+/* Gemini Browser - Happy Eyeballs (RFC 8305) connection racing */
+#ifndef PALMINI_CONNECT_H
+#define PALMINI_CONNECT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <poll.h>
+#include <SDL.h>
+#include "resolver.h"
+
+#define CONNECT_ATTEMPT_DELAY_MS 250    /* RFC 8305 "Connection Attempt Delay" */
+
+/* Non-blocking connects to a host's addresses, started one after another
+ * at CONNECT_ATTEMPT_DELAY_MS intervals and raced against each other.
+ * The caller polls the sockets and feeds the results back in. */
+typedef struct {
+    ResolvedAddrs addrs;                /* In attempt order */
+    int socks[RESOLVER_MAX_ADDRS];      /* -1 = not started or failed */
+    int next;                           /* Next address to start */
+    Uint32 next_attempt_at;             /* SDL_GetTicks() of next start */
+    int winner;                         /* Connected socket, or -1 */
+    int winner_index;
+    bool fast_open;                     /* Sockets ask for TCP Fast Open */
+    bool deferred;                      /* The winner's SYN waits for the first
+                                         * write, to carry it (a cookie was cached) */
+} ConnectRace;
+
+typedef struct {
+    unsigned long races;
+    unsigned long won_first;            /* First address connected */
+    unsigned long won_fallback;         /* A later address beat or replaced it */
+    unsigned long failed;
+    unsigned long ipv4_wins;
+    unsigned long ipv6_wins;
+    unsigned long fast_open_tries;      /* Sockets that asked for TCP Fast Open */
+    unsigned long fast_open_deferred;   /* ...and had a cookie, so sent data in the SYN */
+    bool fast_open_unsupported;         /* The kernel refused TCP_FASTOPEN_CONNECT */
+} ConnectStats;
+
+/* Order addrs (preferred family first, then alternating families) and
+ * start the first attempt. With fast_open, sockets use Linux's
+ * TCP_FASTOPEN_CONNECT: where the kernel holds a cookie for the address
+ * the connect completes at once and the SYN goes out with the first
+ * write, otherwise it is an ordinary connect that asks for a cookie. */
+void connect_race_start(ConnectRace *race, const ResolvedAddrs *addrs, uint16_t port,
+                        bool fast_open);
+
+/* Fill fds with the sockets to poll for POLLOUT. Returns the count. */
+int connect_race_pollfds(const ConnectRace *race, struct pollfd *fds, int max_fds);
+
+/* Milliseconds until another attempt is due, or -1 if none is left */
+int connect_race_timeout(const ConnectRace *race);
+
+/* Process poll results and start due attempts. Returns the connected
+ * (still non-blocking) socket, -1 while pending, -2 once every address
+ * has failed. The winning socket belongs to the caller; the rest are closed. */
+int connect_race_step(ConnectRace *race, const struct pollfd *fds, int nfds);
+
+/* Address family of the winning socket */
+int connect_race_family(const ConnectRace *race);
+
+/* Whether the server accepted the data sent in sock's SYN */
+bool connect_syn_data_acked(int sock);
+
+/* Close every socket still in the race */
+void connect_race_abort(ConnectRace *race);
+
+/* Get a snapshot of the counters */
+void connect_stats(ConnectStats *stats);
+
+#endif /* PALMINI_CONNECT_H */
@@ -0,0 +1,357 @@
+/* Gemini Browser - Persistent on-disk page cache */
+#define _GNU_SOURCE
+#include "disk_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The index is a fixed-size, set-associative hash table that is mapped
+ * straight into memory, so opening it costs no parsing. Each slot owns
+ * one data file named after the slot number. A data file is written
+ * under a temporary name and renamed into place before its slot is
+ * updated, and every read checks the file against the slot and the key,
+ * so a crash at any point leaves at worst a miss. */
+
+#define INDEX_MAGIC     0x47444331  /* "GDC1" */
+#define DATA_MAGIC      0x47444631  /* "GDF1" */
+#define INDEX_SLOTS     (DISK_CACHE_SETS * DISK_CACHE_WAYS)
+#define CHECK_SALT      0x5bd1e995
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sets;
+    uint32_t ways;
+    uint32_t reserved;
+} IndexHeader;
+
+typedef struct {
+    uint32_t hash;              /* Of the key, 0 = empty */
+    uint32_t size;              /* Data file size */
+    uint32_t stored;            /* time() when written */
+    uint32_t last_used;         /* time() of the last hit */
+    uint32_t check;             /* Over hash, size, stored - catches torn writes */
+} IndexSlot;
+
+/* Data file header, followed by meta, key and body */
+typedef struct {
+    uint32_t magic;
+    int32_t status;
+    uint32_t meta_len;
+    uint32_t key_len;
+    uint32_t body_len;
+} DataHeader;
+
+static char cache_dir[256];
+static IndexHeader *index_map = NULL;
+static IndexSlot *slots = NULL;
+static size_t index_size = 0;
+static DiskCacheStats stats;
+
+/* FNV-1a, with 0 kept free to mark empty slots */
+static uint32_t hash_key(const char *key) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h ? h : 1;
+}
+
+static uint32_t slot_check(const IndexSlot *s) {
+    return s->hash ^ s->size ^ s->stored ^ CHECK_SALT;
+}
+
+static bool slot_valid(const IndexSlot *s) {
+    return s->hash != 0 && s->check == slot_check(s);
+}
+
+static void data_path(char *path, size_t len, int slot, const char *suffix) {
+    snprintf(path, len, "%s/%04d.%s", cache_dir, slot, suffix);
+}
+
+static void slot_clear(int index) {
+    char path[300];
+    data_path(path, sizeof(path), index, "dat");
+    unlink(path);
+    memset(&slots[index], 0, sizeof(IndexSlot));
+}
+
+static int find_slot(const char *key) {
+    uint32_t h = hash_key(key);
+    int base = (h % DISK_CACHE_SETS) * DISK_CACHE_WAYS;
+    for (int i = base; i < base + DISK_CACHE_WAYS; i++) {
+        if (slots[i].hash == h && slot_valid(&slots[i])) return i;
+    }
+    return -1;
+}
+
+/* Slot for a new key: an empty way in its set, else the set's LRU */
+static int victim_slot(const char *key) {
+    int base = (hash_key(key) % DISK_CACHE_SETS) * DISK_CACHE_WAYS;
+    int victim = base;
+    for (int i = base; i < base + DISK_CACHE_WAYS; i++) {
+        if (!slot_valid(&slots[i])) return i;
+        if (slots[i].last_used < slots[victim].last_used) victim = i;
+    }
+    stats.evictions++;
+    return victim;
+}
+
+static size_t total_size(void) {
+    size_t total = 0;
+    for (int i = 0; i < INDEX_SLOTS; i++) {
+        if (slot_valid(&slots[i])) total += slots[i].size;
+    }
+    return total;
+}
+
+/* Evict least recently used entries other than keep until under the limit */
+static void enforce_limit(int keep) {
+    size_t total = total_size();
+    while (total > DISK_CACHE_MAX_BYTES) {
+        int victim = -1;
+        for (int i = 0; i < INDEX_SLOTS; i++) {
+            if (i == keep || !slot_valid(&slots[i])) continue;
+            if (victim < 0 || slots[i].last_used < slots[victim].last_used) victim = i;
+        }
+        if (victim < 0) break;
+
+        total -= slots[victim].size;
+        slot_clear(victim);
+        stats.evictions++;
+    }
+}
+
+bool disk_cache_init(const char *dir) {
+    if (!dir) return false;
+    strncpy(cache_dir, dir, sizeof(cache_dir) - 1);
+    mkdir(cache_dir, 0755);
+
+    char path[300];
+    snprintf(path, sizeof(path), "%s/index", cache_dir);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+
+    index_size = sizeof(IndexHeader) + INDEX_SLOTS * sizeof(IndexSlot);
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || (size_t)st.st_size != index_size;
+    if (fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, index_size) != 0)) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, index_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    index_map = map;
+    slots = (IndexSlot *)(index_map + 1);
+
+    /* A foreign or older layout is started over; its data files are
+     * overwritten as slots get reused */
+    if (index_map->magic != INDEX_MAGIC || index_map->sets != DISK_CACHE_SETS ||
+        index_map->ways != DISK_CACHE_WAYS) {
+        memset(map, 0, index_size);
+        index_map->magic = INDEX_MAGIC;
+        index_map->sets = DISK_CACHE_SETS;
+        index_map->ways = DISK_CACHE_WAYS;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    return true;
+}
+
+void disk_cache_cleanup(void) {
+    if (!index_map) return;
+    msync(index_map, index_size, MS_SYNC);
+    munmap(index_map, index_size);
+    index_map = NULL;
+    slots = NULL;
+}
+
+void disk_cache_sync(void) {
+    if (index_map) msync(index_map, index_size, MS_ASYNC);
+}
+
+static bool read_exact(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_exact(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Read the data file of slot index, checking it against the slot and key */
+static GeminiResponse *read_entry(int fd, int index, const char *key) {
+    DataHeader h;
+    size_t key_len = strlen(key);
+    if (!read_exact(fd, &h, sizeof(h)) || h.magic != DATA_MAGIC ||
+        h.meta_len >= sizeof(((GeminiResponse *)0)->meta) || h.key_len != key_len ||
+        sizeof(h) + h.meta_len + h.key_len + h.body_len != slots[index].size) {
+        return NULL;
+    }
+
+    GeminiResponse *resp = calloc(1, sizeof(GeminiResponse));
+    char *stored_key = malloc(key_len + 1);
+    bool ok = resp && stored_key &&
+              read_exact(fd, resp->meta, h.meta_len) &&
+              read_exact(fd, stored_key, key_len);
+    if (ok) {
+        /* Another key with the same hash */
+        stored_key[key_len] = '\0';
+        ok = strcmp(stored_key, key) == 0;
+    }
+    if (ok && h.body_len) {
+        resp->body = malloc(h.body_len + 1);
+        ok = resp->body && read_exact(fd, resp->body, h.body_len);
+        if (ok) {
+            resp->body[h.body_len] = '\0';
+            resp->body_len = h.body_len;
+        }
+    }
+    free(stored_key);
+
+    if (!ok) {
+        gemini_response_free(resp);
+        return NULL;
+    }
+    resp->status = h.status;
+    return resp;
+}
+
+bool disk_cache_get(const char *key, GeminiResponse **out, long *age_sec) {
+    if (!slots || !key || !out) return false;
+    *out = NULL;
+
+    stats.lookups++;
+    int index = find_slot(key);
+    if (index < 0) return false;
+
+    char path[300];
+    data_path(path, sizeof(path), index, "dat");
+    int fd = open(path, O_RDONLY);
+    GeminiResponse *resp = fd >= 0 ? read_entry(fd, index, key) : NULL;
+    if (fd >= 0) close(fd);
+    if (!resp) {
+        slot_clear(index);
+        stats.corrupt++;
+        return false;
+    }
+
+    slots[index].last_used = (uint32_t)time(NULL);
+    if (age_sec) *age_sec = (long)(slots[index].last_used - slots[index].stored);
+    stats.hits++;
+    *out = resp;
+    return true;
+}
+
+long disk_cache_age(const char *key) {
+    if (!slots || !key) return -1;
+
+    int index = find_slot(key);
+    if (index < 0) return -1;
+    return (long)((uint32_t)time(NULL) - slots[index].stored);
+}
+
+void disk_cache_put(const char *key, const GeminiResponse *resp) {
+    if (!slots || !key || !resp) return;
+
+    int index = find_slot(key);
+    if (index < 0) index = victim_slot(key);
+
+    DataHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = DATA_MAGIC;
+    h.status = resp->status;
+    h.meta_len = strlen(resp->meta);
+    h.key_len = strlen(key);
+    h.body_len = resp->body ? resp->body_len : 0;
+
+    char tmp_path[300], path[300];
+    data_path(tmp_path, sizeof(tmp_path), index, "tmp");
+    data_path(path, sizeof(path), index, "dat");
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    bool ok = write_exact(fd, &h, sizeof(h)) &&
+              write_exact(fd, resp->meta, h.meta_len) &&
+              write_exact(fd, key, h.key_len) &&
+              write_exact(fd, resp->body, h.body_len);
+    close(fd);
+
+    /* Invalidate the slot first: between the rename and the slot update
+     * it would otherwise describe a file that isn't there */
+    memset(&slots[index], 0, sizeof(IndexSlot));
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return;
+    }
+
+    IndexSlot *s = &slots[index];
+    s->size = sizeof(h) + h.meta_len + h.key_len + h.body_len;
+    s->stored = (uint32_t)time(NULL);
+    s->last_used = s->stored;
+    s->hash = hash_key(key);
+    s->check = slot_check(s);
+    stats.writes++;
+
+    enforce_limit(index);
+}
+
+void disk_cache_touch(const char *key) {
+    if (!slots || !key) return;
+
+    int index = find_slot(key);
+    if (index < 0) return;
+
+    IndexSlot *s = &slots[index];
+    s->stored = (uint32_t)time(NULL);
+    s->last_used = s->stored;
+    s->check = slot_check(s);
+}
+
+void disk_cache_remove(const char *key) {
+    if (!slots || !key) return;
+
+    int index = find_slot(key);
+    if (index >= 0) slot_clear(index);
+}
+
+void disk_cache_stats(DiskCacheStats *out) {
+    if (!out) return;
+
+    *out = stats;
+    out->entries = 0;
+    out->bytes = 0;
+    if (!slots) return;
+
+    for (int i = 0; i < INDEX_SLOTS; i++) {
+        if (slot_valid(&slots[i])) {
+            out->entries++;
+            out->bytes += slots[i].size;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+/* Gemini Browser - Persistent on-disk page cache */
+#ifndef PALMINI_DISK_CACHE_H
+#define PALMINI_DISK_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "gemini.h"
+
+#define DISK_CACHE_DIR        "/media/internal/gemini-cache"
+#define DISK_CACHE_SETS       128                   /* Hash buckets in the index */
+#define DISK_CACHE_WAYS       8                     /* Entries per bucket */
+#define DISK_CACHE_MAX_BYTES  (8 * 1024 * 1024)     /* Files in total */
+
+typedef struct {
+    unsigned long lookups;
+    unsigned long hits;
+    unsigned long writes;
+    unsigned long evictions;
+    unsigned long corrupt;      /* Entries dropped because the file didn't match */
+    int entries;
+    size_t bytes;
+} DiskCacheStats;
+
+/* The disk cache is only used from the UI thread. Keys are normalized
+ * URLs (see cache.c). */
+
+/* Open (or create) the cache in dir and map its index */
+bool disk_cache_init(const char *dir);
+
+/* Flush and unmap the index */
+void disk_cache_cleanup(void);
+
+/* Write index changes to disk. Safe to call at any time. */
+void disk_cache_sync(void);
+
+/* Read the response stored for key. *age_sec receives how long ago it
+ * was stored. The caller frees *out with gemini_response_free(). */
+bool disk_cache_get(const char *key, GeminiResponse **out, long *age_sec);
+
+/* Seconds since key was stored, from the index alone, or -1 if absent */
+long disk_cache_age(const char *key);
+
+/* Store resp under key, replacing any older copy */
+void disk_cache_put(const char *key, const GeminiResponse *resp);
+
+/* Mark key as stored just now without rewriting it */
+void disk_cache_touch(const char *key);
+
+/* Forget key */
+void disk_cache_remove(const char *key);
+
+/* Get a snapshot of the counters */
+void disk_cache_stats(DiskCacheStats *stats);
+
+#endif /* PALMINI_DISK_CACHE_H */
@@ -2,47 +2,115 @@
 #define _GNU_SOURCE
 #include "document.h"
 #include "unicode.h"
+#include "textscan.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
-#define INITIAL_CAPACITY 64
+#define INITIAL_CAPACITY    64
+#define INITIAL_ARENA       1024
+#define INITIAL_LINKS       16
+#define INITIAL_HEADINGS    16
 
-Document *document_new(void) {
+static Document *document_alloc(size_t capacity, size_t arena_capacity) {
     Document *doc = calloc(1, sizeof(Document));
     if (!doc) return NULL;
 
-    doc->capacity = INITIAL_CAPACITY;
-    doc->lines = calloc(doc->capacity, sizeof(DocLine));
-    if (!doc->lines) {
-        free(doc);
+    doc->capacity = capacity;
+    doc->lines = malloc(capacity * sizeof(DocLine));
+    doc->arena_capacity = arena_capacity;
+    doc->arena = malloc(arena_capacity);
+    if (!doc->lines || !doc->arena) {
+        document_free(doc);
         return NULL;
     }
 
+    /* Offset 0 is the empty string every empty slice points at */
+    doc->arena[0] = '\0';
+    doc->arena_len = 1;
     return doc;
 }
 
+Document *document_new(void) {
+    return document_alloc(INITIAL_CAPACITY, INITIAL_ARENA);
+}
+
 void document_free(Document *doc) {
     if (!doc) return;
 
-    for (size_t i = 0; i < doc->num_lines; i++) {
-        free(doc->lines[i].text);
-        free(doc->lines[i].url);
-    }
     free(doc->lines);
-    free(doc->title);
+    free(doc->arena);
+    free(doc->links);
+    free(doc->headings);
     free(doc);
 }
 
-bool document_add_line(Document *doc, LineType type, const char *text, const char *url) {
-    if (!doc) return false;
+/* Make room for need more bytes in the arena */
+static bool arena_reserve(Document *doc, size_t need) {
+    if (need <= doc->arena_capacity - doc->arena_len) return true;
+
+    size_t capacity = doc->arena_capacity * 2;
+    while (capacity - doc->arena_len < need) capacity *= 2;
+    char *arena = realloc(doc->arena, capacity);
+    if (!arena) return false;
+    doc->arena = arena;
+    doc->arena_capacity = capacity;
+    return true;
+}
+
+/* Copy len bytes of str into the arena as they are */
+static DocSlice arena_add(Document *doc, const char *str, size_t len) {
+    DocSlice slice = { 0, 0 };
+    if (!arena_reserve(doc, len + 1)) return slice;
+
+    slice.off = doc->arena_len;
+    slice.len = len;
+    memcpy(doc->arena + slice.off, str, len);
+    doc->arena[slice.off + len] = '\0';
+    doc->arena_len += len + 1;
+    return slice;
+}
+
+/* Sanitize len bytes of text for Unicode 6.0 into the arena */
+static DocSlice arena_add_text(Document *doc, const char *text, size_t len) {
+    DocSlice slice = { 0, 0 };
+    if (len == 0 || !arena_reserve(doc, len + 1)) return slice;
+
+    /* Fallbacks rarely make text longer, so this seldom runs twice */
+    char *out = doc->arena + doc->arena_len;
+    size_t room = doc->arena_capacity - doc->arena_len;
+    size_t out_len = unicode_sanitize_to(out, room, text, len);
+    if (out_len >= room) {
+        if (!arena_reserve(doc, out_len + 1)) return slice;
+        out = doc->arena + doc->arena_len;
+        unicode_sanitize_to(out, out_len + 1, text, len);
+    }
+
+    slice.off = doc->arena_len;
+    slice.len = out_len;
+    doc->arena_len += out_len + 1;
+    return slice;
+}
 
+static bool reserve_links(Document *doc, size_t capacity) {
+    if (capacity <= doc->links_capacity) return true;
+
+    DocLink *links = realloc(doc->links, capacity * sizeof(DocLink));
+    if (!links) return false;
+    doc->links = links;
+    doc->links_capacity = capacity;
+    return true;
+}
+
+/* Append a line with text already sliced out of its source */
+static DocLine *add_line(Document *doc, LineType type, const char *text, size_t text_len,
+                         const char *url, size_t url_len) {
     /* Grow array if needed */
     if (doc->num_lines >= doc->capacity) {
         size_t new_capacity = doc->capacity * 2;
         DocLine *new_lines = realloc(doc->lines, new_capacity * sizeof(DocLine));
-        if (!new_lines) return false;
+        if (!new_lines) return NULL;
         doc->lines = new_lines;
         doc->capacity = new_capacity;
     }
@@ -51,198 +119,338 @@ bool document_add_line(Document *doc, LineType type, const char *text, const cha
     memset(line, 0, sizeof(DocLine));
 
     line->type = type;
-    /* Sanitize text for Unicode 6.0 compatibility */
-    line->text = text ? unicode_sanitize(text) : strdup("");
-    if (!line->text) line->text = strdup("");  /* Fallback on sanitize failure */
+    line->text = arena_add_text(doc, text, text_len);
     if (url) {
-        line->url = strdup(url);
+        line->url = arena_add(doc, url, url_len);
+    }
+
+    /* Index links as they come, so walking them never scans the lines */
+    if (type == LINE_LINK) {
+        if (doc->num_links >= doc->links_capacity &&
+            !reserve_links(doc, doc->links_capacity ? doc->links_capacity * 2 : INITIAL_LINKS)) {
+            return NULL;
+        }
+        line->link = doc->num_links;
+        doc->links[doc->num_links].line = doc->num_lines;
+        doc->links[doc->num_links].resolved = (DocSlice){ 0, 0 };
+        doc->num_links++;
+    }
+
+    /* Outline entry, laid out later */
+    if (type == LINE_HEADING1 || type == LINE_HEADING2 || type == LINE_HEADING3) {
+        if (doc->num_headings >= doc->headings_capacity) {
+            size_t capacity = doc->headings_capacity ? doc->headings_capacity * 2 : INITIAL_HEADINGS;
+            DocHeading *headings = realloc(doc->headings, capacity * sizeof(DocHeading));
+            if (!headings) return NULL;
+            doc->headings = headings;
+            doc->headings_capacity = capacity;
+        }
+        DocHeading *heading = &doc->headings[doc->num_headings++];
+        heading->line = doc->num_lines;
+        heading->level = type == LINE_HEADING1 ? 1 : type == LINE_HEADING2 ? 2 : 3;
+        heading->y = 0;
     }
 
     doc->num_lines++;
-    return true;
+    return line;
 }
 
-/* Helper to trim trailing whitespace */
-static void trim_trailing(char *str) {
-    if (!str) return;
-    size_t len = strlen(str);
-    while (len > 0 && isspace((unsigned char)str[len - 1])) {
-        str[--len] = '\0';
-    }
+bool document_add_line(Document *doc, LineType type, const char *text, const char *url) {
+    if (!doc) return false;
+
+    return add_line(doc, type, text ? text : "", text ? strlen(text) : 0,
+                    url, url ? strlen(url) : 0) != NULL;
 }
 
-/* Helper to skip leading whitespace */
-static const char *skip_whitespace(const char *str) {
-    while (*str && isspace((unsigned char)*str)) str++;
-    return str;
+const char *document_line_text(const Document *doc, const DocLine *line) {
+    return doc->arena + line->text.off;
 }
 
-Document *document_parse(const char *gemtext, size_t len) {
-    if (!gemtext) return NULL;
+const char *document_line_url(const Document *doc, const DocLine *line) {
+    return line->url.off ? doc->arena + line->url.off : NULL;
+}
 
-    Document *doc = document_new();
-    if (!doc) return NULL;
+const char *document_title(const Document *doc) {
+    return doc->title.len ? doc->arena + doc->title.off : NULL;
+}
 
-    bool in_preformatted = false;
-    int preformat_block = 0;
+/* Helper to trim trailing whitespace, returns the new end */
+static const char *trim_trailing(const char *start, const char *end) {
+    while (end > start && isspace((unsigned char)end[-1])) end--;
+    return end;
+}
 
-    const char *p = gemtext;
-    const char *end = gemtext + len;
+/* Helper to skip leading whitespace */
+static const char *skip_whitespace(const char *str, const char *end) {
+    while (str < end && isspace((unsigned char)*str)) str++;
+    return str;
+}
 
-    while (p < end) {
-        /* Find end of line */
-        const char *line_start = p;
-        const char *line_end = p;
-        while (line_end < end && *line_end != '\n' && *line_end != '\r') {
-            line_end++;
-        }
+static bool starts_with(const char *line, const char *end, const char *prefix) {
+    size_t len = strlen(prefix);
+    return (size_t)(end - line) >= len && memcmp(line, prefix, len) == 0;
+}
 
-        /* Extract line content */
-        size_t line_len = line_end - line_start;
-        char *line = malloc(line_len + 1);
-        if (!line) break;
-        memcpy(line, line_start, line_len);
-        line[line_len] = '\0';
-
-        /* Handle preformatted toggle */
-        if (strncmp(line, "```", 3) == 0) {
-            in_preformatted = !in_preformatted;
-            if (in_preformatted) {
-                preformat_block++;
-            }
-            free(line);
-            /* Skip to next line */
-            p = line_end;
-            if (p < end && *p == '\r') p++;
-            if (p < end && *p == '\n') p++;
-            continue;
+/* Add one complete line, without its line break */
+static void parse_line(DocParser *parser, const char *line, const char *line_end) {
+    Document *doc = parser->doc;
+
+    /* Handle preformatted toggle */
+    if (starts_with(line, line_end, "```")) {
+        parser->in_preformatted = !parser->in_preformatted;
+        if (parser->in_preformatted) {
+            parser->preformat_block++;
         }
+        return;
+    }
 
-        if (in_preformatted) {
-            /* Preformatted text - preserve as-is */
-            document_add_line(doc, LINE_PREFORMATTED, line, NULL);
-            if (doc->num_lines > 0) {
-                doc->lines[doc->num_lines - 1].preformat_block = preformat_block;
-            }
+    if (parser->in_preformatted) {
+        /* Preformatted text - preserve as-is */
+        DocLine *added = add_line(doc, LINE_PREFORMATTED, line, line_end - line, NULL, 0);
+        if (added) {
+            added->preformat_block = parser->preformat_block;
         }
-        else if (strncmp(line, "=>", 2) == 0) {
+        return;
+    }
+
+    LineType type = LINE_TEXT;
+    const char *text = line;
+    const char *url = NULL;
+    size_t url_len = 0;
+
+    /* Each prefix has its own first byte, so one switch classifies the
+     * line instead of a string compare per line type */
+    switch (line < line_end ? *line : '\0') {
+        case '=': {
+            if (!starts_with(line, line_end, "=>")) break;
+
             /* Link line */
-            const char *rest = line + 2;
-            rest = skip_whitespace(rest);
+            type = LINE_LINK;
+            url = skip_whitespace(line + 2, line_end);
 
             /* Find URL end (first whitespace) */
-            const char *url_start = rest;
-            const char *url_end = rest;
-            while (*url_end && !isspace((unsigned char)*url_end)) {
+            const char *url_end = url;
+            while (url_end < line_end && !isspace((unsigned char)*url_end)) {
                 url_end++;
             }
+            url_len = url_end - url;
 
-            /* Extract URL */
-            size_t url_len = url_end - url_start;
-            char *url = malloc(url_len + 1);
-            if (url) {
-                memcpy(url, url_start, url_len);
-                url[url_len] = '\0';
-            }
+            /* Get label (rest of line after URL), or the URL if none */
+            text = skip_whitespace(url_end, line_end);
+            if (text == line_end) text = url;
+            break;
+        }
 
-            /* Get label (rest of line after URL) */
-            const char *label = skip_whitespace(url_end);
-            char *label_copy = strdup(label[0] ? label : url ? url : "");
-            trim_trailing(label_copy);
+        case '#': {
+            /* Heading, level 1 to 3 */
+            int level = 1;
+            while (level < 3 && line + level < line_end && line[level] == '#') level++;
+            type = level == 1 ? LINE_HEADING1 : level == 2 ? LINE_HEADING2 : LINE_HEADING3;
+            text = skip_whitespace(line + level, line_end);
+            break;
+        }
 
-            document_add_line(doc, LINE_LINK, label_copy, url);
+        case '*':
+            if (!starts_with(line, line_end, "* ")) break;
+            type = LINE_LIST_ITEM;
+            text = line + 2;
+            break;
 
-            free(label_copy);
-            free(url);
-        }
-        else if (strncmp(line, "###", 3) == 0) {
-            /* Heading 3 */
-            const char *text = skip_whitespace(line + 3);
-            char *text_copy = strdup(text);
-            trim_trailing(text_copy);
-            document_add_line(doc, LINE_HEADING3, text_copy, NULL);
-            free(text_copy);
-        }
-        else if (strncmp(line, "##", 2) == 0) {
-            /* Heading 2 */
-            const char *text = skip_whitespace(line + 2);
-            char *text_copy = strdup(text);
-            trim_trailing(text_copy);
-            document_add_line(doc, LINE_HEADING2, text_copy, NULL);
-            free(text_copy);
+        case '>':
+            type = LINE_QUOTE;
+            text = line + 1;
+            if (text < line_end && *text == ' ') text++;
+            break;
+
+        default:
+            break;
+    }
+
+    const char *text_end = trim_trailing(text, line_end);
+    DocLine *added = add_line(doc, type, text, text_end - text, url, url_len);
+
+    /* First heading becomes the title */
+    if (added && type == LINE_HEADING1 && !doc->title.len) {
+        doc->title = added->text;
+    }
+}
+
+/* Keep the start of a line that the next chunk continues */
+static bool keep_partial(DocParser *parser, const char *data, size_t len) {
+    if (len > parser->partial_capacity - parser->partial_len) {
+        size_t capacity = parser->partial_capacity ? parser->partial_capacity : 256;
+        while (capacity - parser->partial_len < len) capacity *= 2;
+        char *partial = realloc(parser->partial, capacity);
+        if (!partial) return false;
+        parser->partial = partial;
+        parser->partial_capacity = capacity;
+    }
+
+    memcpy(parser->partial + parser->partial_len, data, len);
+    parser->partial_len += len;
+    return true;
+}
+
+static void parser_start(DocParser *parser, Document *doc) {
+    memset(parser, 0, sizeof(*parser));
+    parser->doc = doc;
+}
+
+bool document_parser_init(DocParser *parser) {
+    if (!parser) return false;
+
+    parser_start(parser, document_new());
+    return parser->doc != NULL;
+}
+
+/* Parse a chunk. Unless it is the last, a line it leaves unfinished is
+ * kept for the next one. */
+static void parse_chunk(DocParser *parser, const char *data, size_t len, bool last) {
+    const char *p = data;
+    const char *end = data + len;
+
+    /* The \n of a \r\n split across chunks */
+    if (p < end && parser->after_cr) {
+        if (*p == '\n') p++;
+        parser->after_cr = false;
+    }
+
+    while (p < end) {
+        const char *line_end = textscan_line_end(p, end);
+
+        if (line_end == end && !last) {
+            /* Unfinished - wait for the rest. If this runs out of
+             * memory the line loses its start. */
+            keep_partial(parser, p, end - p);
+            return;
         }
-        else if (line[0] == '#') {
-            /* Heading 1 */
-            const char *text = skip_whitespace(line + 1);
-            char *text_copy = strdup(text);
-            trim_trailing(text_copy);
-            document_add_line(doc, LINE_HEADING1, text_copy, NULL);
-
-            /* First heading becomes the title */
-            if (!doc->title && text_copy[0]) {
-                doc->title = strdup(text_copy);
+
+        if (parser->partial_len > 0) {
+            /* A line that started in an earlier chunk */
+            if (keep_partial(parser, p, line_end - p)) {
+                parse_line(parser, parser->partial, parser->partial + parser->partial_len);
             }
-            free(text_copy);
-        }
-        else if (strncmp(line, "* ", 2) == 0) {
-            /* List item */
-            const char *text = line + 2;
-            char *text_copy = strdup(text);
-            trim_trailing(text_copy);
-            document_add_line(doc, LINE_LIST_ITEM, text_copy, NULL);
-            free(text_copy);
-        }
-        else if (line[0] == '>') {
-            /* Quote */
-            const char *text = line + 1;
-            if (*text == ' ') text++;
-            char *text_copy = strdup(text);
-            trim_trailing(text_copy);
-            document_add_line(doc, LINE_QUOTE, text_copy, NULL);
-            free(text_copy);
+            parser->partial_len = 0;
         }
         else {
-            /* Regular text */
-            char *text_copy = strdup(line);
-            trim_trailing(text_copy);
-            document_add_line(doc, LINE_TEXT, text_copy, NULL);
-            free(text_copy);
+            parse_line(parser, p, line_end);
         }
 
-        free(line);
-
         /* Skip to next line */
         p = line_end;
-        if (p < end && *p == '\r') p++;
+        if (p < end && *p == '\r' && ++p == end) parser->after_cr = true;
         if (p < end && *p == '\n') p++;
     }
+}
+
+size_t document_parser_feed(DocParser *parser, const char *data, size_t len) {
+    if (!parser || !parser->doc || !data) return 0;
+
+    size_t before = parser->doc->num_lines;
+    parse_chunk(parser, data, len, false);
+    return parser->doc->num_lines - before;
+}
+
+size_t document_parser_finish(DocParser *parser) {
+    if (!parser || !parser->doc || parser->partial_len == 0) return 0;
+
+    size_t before = parser->doc->num_lines;
+    parse_line(parser, parser->partial, parser->partial + parser->partial_len);
+    parser->partial_len = 0;
+    parser->after_cr = false;
+    return parser->doc->num_lines - before;
+}
+
+Document *document_parser_take(DocParser *parser) {
+    if (!parser) return NULL;
 
+    Document *doc = parser->doc;
+    free(parser->partial);
+    memset(parser, 0, sizeof(*parser));
     return doc;
 }
 
-size_t document_link_count(const Document *doc) {
-    if (!doc) return 0;
+Document *document_parse(const char *gemtext, size_t len) {
+    if (!gemtext) return NULL;
 
-    size_t count = 0;
-    for (size_t i = 0; i < doc->num_lines; i++) {
-        if (doc->lines[i].type == LINE_LINK) {
-            count++;
-        }
+    /* Size the arrays up front: a line per newline, a link per line
+     * starting with =>, and about the source's length of text */
+    size_t num_lines = 1;
+    size_t num_links = starts_with(gemtext, gemtext + len, "=>");
+    for (const char *nl = gemtext; (nl = memchr(nl, '\n', gemtext + len - nl)) != NULL; nl++) {
+        num_lines++;
+        if (starts_with(nl + 1, gemtext + len, "=>")) num_links++;
     }
-    return count;
+    Document *doc = document_alloc(num_lines, len + len / 16 + INITIAL_ARENA);
+    if (!doc) return NULL;
+    reserve_links(doc, num_links);
+
+    DocParser parser;
+    parser_start(&parser, doc);
+    parse_chunk(&parser, gemtext, len, true);
+    return document_parser_take(&parser);
+}
+
+size_t document_link_count(const Document *doc) {
+    return doc ? doc->num_links : 0;
 }
 
 const char *document_link_url(const Document *doc, size_t index) {
-    if (!doc) return NULL;
+    if (!doc || index >= doc->num_links) return NULL;
+    return document_line_url(doc, &doc->lines[doc->links[index].line]);
+}
 
-    size_t link_idx = 0;
-    for (size_t i = 0; i < doc->num_lines; i++) {
-        if (doc->lines[i].type == LINE_LINK) {
-            if (link_idx == index) {
-                return doc->lines[i].url;
-            }
-            link_idx++;
+size_t document_link_line(const Document *doc, size_t index) {
+    return doc && index < doc->num_links ? doc->links[index].line : 0;
+}
+
+void document_resolve_links(Document *doc, const Url *base) {
+    if (!doc) return;
+
+    for (size_t i = 0; i < doc->num_links; i++) {
+        DocLink *link = &doc->links[i];
+        const char *href = document_line_url(doc, &doc->lines[link->line]);
+        link->resolved = (DocSlice){ 0, 0 };
+        if (!href) continue;
+
+        Url url;
+        bool valid;
+        if (base && base->host[0] && !strstr(href, "://")) {
+            valid = url_resolve(base, href, &url);
+        }
+        else {
+            valid = url_parse(href, &url);
         }
+        if (valid) {
+            link->resolved = arena_add(doc, url.full, strlen(url.full));
+        }
+    }
+}
+
+const char *document_link_resolved(const Document *doc, size_t index) {
+    if (!doc || index >= doc->num_links || !doc->links[index].resolved.off) return NULL;
+    return doc->arena + doc->links[index].resolved.off;
+}
+
+bool document_set_link_resolved(Document *doc, size_t index, const char *url) {
+    if (!doc || index >= doc->num_links || !url) return false;
+
+    /* The old URL stays in the arena until the document is freed */
+    DocSlice slice = arena_add(doc, url, strlen(url));
+    if (!slice.off) return false;
+    doc->links[index].resolved = slice;
+    return true;
+}
+
+int document_heading_before(const Document *doc, int y) {
+    if (!doc) return -1;
+
+    /* First laid-out heading at or below y */
+    size_t lo = 0, hi = doc->layout_headings;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (doc->headings[mid].y < y) lo = mid + 1;
+        else hi = mid;
     }
-    return NULL;
+    return (int)lo - 1;
 }
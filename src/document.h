@@ -4,6 +4,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "url.h"
 
 /* Line types in a Gemtext document */
 typedef enum {
@@ -17,38 +18,134 @@ typedef enum {
     LINE_PREFORMATTED
 } LineType;
 
+/* A NUL-terminated string in a document's arena, len bytes long at
+ * arena + off. Offset 0 holds an empty string. */
+typedef struct {
+    size_t off;
+    size_t len;
+} DocSlice;
+
 /* A single line in a document */
 typedef struct {
     LineType type;
-    char *text;             /* Display text */
-    char *url;              /* For links only */
+    DocSlice text;          /* Display text */
+    DocSlice url;           /* For links only, off 0 = none */
     int preformat_block;    /* Which preformat block this belongs to (0 = not preformatted) */
+    size_t link;            /* For links, its index in the link table */
 } DocLine;
 
-/* A parsed Gemtext document */
+/* An entry in a document's link table, in document order */
+typedef struct {
+    size_t line;            /* Index in lines */
+    DocSlice resolved;      /* Absolute URL, off 0 = not resolved */
+} DocLink;
+
+/* An entry in a document's outline, in document order */
+typedef struct {
+    size_t line;            /* Index in lines */
+    int level;              /* 1 to 3 */
+    int y;                  /* Offset from the top of the page once laid
+                             * out, see render_layout() */
+} DocHeading;
+
+/* A parsed Gemtext document. The text and URLs of all lines live in one
+ * arena, so a page costs a handful of allocations however long it is.
+ * The arena may move as lines are added: keep slices, not pointers. */
 typedef struct {
     DocLine *lines;
     size_t num_lines;
     size_t capacity;
-    char *title;            /* First heading, if any */
+    char *arena;
+    size_t arena_len;
+    size_t arena_capacity;
+    DocSlice title;         /* First heading, len 0 = none */
+    DocLink *links;
+    size_t num_links;
+    size_t links_capacity;
+    DocHeading *headings;
+    size_t num_headings;
+    size_t headings_capacity;
+
+    /* How far render_layout() has got: lines measured, the headings
+     * among them and their total height. Lines appended later are
+     * measured on the next call, without starting over. */
+    size_t layout_lines;
+    size_t layout_headings;
+    int layout_height;
 } Document;
 
+/* Push parser state. Data can be fed in chunks split anywhere, even
+ * inside a line or a UTF-8 sequence: the unfinished line is kept until
+ * the chunk that ends it arrives. */
+typedef struct {
+    Document *doc;          /* Lines parsed so far */
+    bool in_preformatted;
+    int preformat_block;
+    bool after_cr;          /* Last chunk ended in \r, so a leading \n is its break */
+    char *partial;          /* Unfinished last line */
+    size_t partial_len;
+    size_t partial_capacity;
+} DocParser;
+
 /* Create a new empty document */
 Document *document_new(void);
 
 /* Parse Gemtext content into a document */
 Document *document_parse(const char *gemtext, size_t len);
 
+/* Start parsing into a new empty document */
+bool document_parser_init(DocParser *parser);
+
+/* Parse the next chunk of Gemtext. Returns how many lines were appended:
+ * they are the last that many of parser->doc. */
+size_t document_parser_feed(DocParser *parser, const char *data, size_t len);
+
+/* Parse the last line if the data didn't end with a line break. Returns
+ * how many lines were appended, as document_parser_feed() does. */
+size_t document_parser_finish(DocParser *parser);
+
+/* Free the parser state and return its document, which the caller now
+ * owns */
+Document *document_parser_take(DocParser *parser);
+
 /* Free a document */
 void document_free(Document *doc);
 
 /* Add a line to a document */
 bool document_add_line(Document *doc, LineType type, const char *text, const char *url);
 
+/* Text of a line */
+const char *document_line_text(const Document *doc, const DocLine *line);
+
+/* URL of a link line, or NULL */
+const char *document_line_url(const Document *doc, const DocLine *line);
+
+
+/* Title of the document, or NULL */
+const char *document_title(const Document *doc);
+
 /* Get the number of links in a document */
 size_t document_link_count(const Document *doc);
 
-/* Get the URL of a link by index (0-based) */
+/* Get the URL of a link by index (0-based), as the page wrote it */
 const char *document_link_url(const Document *doc, size_t index);
 
+/* Line of a link by index */
+size_t document_link_line(const Document *doc, size_t index);
+
+/* Resolve every link against base, the URL the document came from, so
+ * each can be followed without parsing it again. Links that don't parse
+ * stay unresolved. */
+void document_resolve_links(Document *doc, const Url *base);
+
+/* Absolute URL of a link by index, or NULL if it is not resolved */
+const char *document_link_resolved(const Document *doc, size_t index);
+
+/* Send a link to url instead, e.g. where its target moved */
+bool document_set_link_resolved(Document *doc, size_t index, const char *url);
+
+/* Index of the last laid-out heading that starts above offset y, or -1.
+ * A binary search, as headings are laid out in order. */
+int document_heading_before(const Document *doc, int y);
+
 #endif /* PALMINI_DOCUMENT_H */
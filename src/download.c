@@ -0,0 +1,269 @@
+/* Gemini Browser - Saving files that can't be displayed */
+#include "download.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+typedef struct {
+    DownloadInfo info;
+    GeminiRequest *req;         /* While running */
+    int fd;
+    Uint32 started;             /* SDL_GetTicks() */
+
+    /* Written on the engine thread */
+    volatile size_t written;
+    volatile int write_errno;
+} Download;
+
+static char download_dir[256] = DOWNLOAD_DIR;
+static Download downloads[DOWNLOAD_MAX];
+
+static void part_path(char *path, size_t len, const Download *d) {
+    snprintf(path, len, "%s.part", d->info.path);
+}
+
+/* Engine thread: only a page of the expected kind is saved */
+static bool download_on_header(const GeminiResponse *resp, void *userdata) {
+    (void)userdata;
+    return gemini_status_category(resp->status) == 2;
+}
+
+/* Engine thread: each chunk goes straight to the file */
+static bool download_on_body(const char *data, size_t len, void *userdata) {
+    Download *d = userdata;
+    while (len > 0) {
+        ssize_t n = write(d->fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            d->write_errno = n < 0 ? errno : ENOSPC;
+            return false;
+        }
+        data += n;
+        len -= n;
+        d->written += n;
+    }
+    return true;
+}
+
+static const GeminiStreamHandler download_handler = { download_on_header, download_on_body };
+
+static bool path_in_use(const char *path) {
+    char part[320];
+    snprintf(part, sizeof(part), "%s.part", path);
+    if (access(path, F_OK) == 0 || access(part, F_OK) == 0) return true;
+
+    for (int i = 0; i < DOWNLOAD_MAX; i++) {
+        if (downloads[i].info.state == DOWNLOAD_RUNNING &&
+            strcmp(downloads[i].info.path, path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* File name from the last path segment, falling back to the host */
+static void file_name(char *name, size_t len, const Url *url) {
+    char segment[sizeof(url->path)];
+    const char *slash = strrchr(url->path, '/');
+    strncpy(segment, slash ? slash + 1 : url->path, sizeof(segment) - 1);
+    segment[sizeof(segment) - 1] = '\0';
+    url_decode(segment);
+
+    /* Nothing that leaves the directory or hides the file */
+    char *src = segment;
+    while (*src == '.') src++;
+    size_t n = 0;
+    for (; *src && n < len - 1; src++) {
+        unsigned char ch = (unsigned char)*src;
+        name[n++] = (ch == '/' || ch == '\\' || ch < 0x20) ? '_' : ch;
+    }
+    name[n] = '\0';
+
+    if (n == 0) snprintf(name, len, "%s", url->host[0] ? url->host : "download");
+}
+
+/* A path in the download directory that no other file has, numbering
+ * the name before its extension if needed: "song.ogg", "song-1.ogg"... */
+static bool unique_path(char *path, size_t len, const char *name) {
+    char stem[128];
+    snprintf(stem, sizeof(stem), "%s", name);
+    const char *ext = "";
+    char *dot = strrchr(stem, '.');
+    if (dot && dot != stem) {
+        ext = name + (dot - stem);
+        *dot = '\0';
+    }
+
+    for (int i = 0; i < 100; i++) {
+        if (i == 0) {
+            snprintf(path, len, "%s/%s%s", download_dir, stem, ext);
+        }
+        else {
+            snprintf(path, len, "%s/%s-%d%s", download_dir, stem, i, ext);
+        }
+        if (!path_in_use(path)) return true;
+    }
+    return false;
+}
+
+/* An unused slot, else the one that finished longest ago */
+static Download *free_slot(void) {
+    Download *oldest = NULL;
+    for (int i = 0; i < DOWNLOAD_MAX; i++) {
+        Download *d = &downloads[i];
+        if (d->info.state == DOWNLOAD_NONE) return d;
+        if (d->info.state != DOWNLOAD_RUNNING &&
+            (!oldest || (Sint32)(d->started - oldest->started) < 0)) {
+            oldest = d;
+        }
+    }
+    return oldest;
+}
+
+bool download_init(const char *dir) {
+    if (!dir) return false;
+    snprintf(download_dir, sizeof(download_dir), "%s", dir);
+    mkdir(download_dir, 0755);
+
+    struct stat st;
+    return stat(download_dir, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int download_start(const Url *url, const char *mime) {
+    if (!url) return -1;
+
+    Download *d = free_slot();
+    if (!d) return -1;
+
+    char name[128];
+    char path[sizeof(d->info.path)];
+    file_name(name, sizeof(name), url);
+    if (!unique_path(path, sizeof(path), name)) return -1;
+
+    char part[sizeof(path) + 8];
+    snprintf(part, sizeof(part), "%s.part", path);
+    int fd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    memset(d, 0, sizeof(*d));
+    d->fd = fd;
+    d->started = SDL_GetTicks();
+    d->info.state = DOWNLOAD_RUNNING;
+    strncpy(d->info.url, url->full, sizeof(d->info.url) - 1);
+    strncpy(d->info.path, path, sizeof(d->info.path) - 1);
+    strncpy(d->info.mime, mime ? mime : "", sizeof(d->info.mime) - 1);
+
+    GeminiRequestOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.priority = GEMINI_PRIORITY_BULK;
+    opts.deadline = d->started + DOWNLOAD_START_MS;
+    opts.idle_timeout = DOWNLOAD_IDLE_MS;   /* The body takes as long as it needs */
+    opts.handler = &download_handler;
+    opts.handler_data = d;
+    d->req = gemini_fetch_async_ex(url, &opts);
+    if (!d->req) {
+        close(fd);
+        unlink(part);
+        memset(d, 0, sizeof(*d));
+        return -1;
+    }
+    return (int)(d - downloads);
+}
+
+bool download_done(GeminiRequest *req) {
+    Download *d = NULL;
+    for (int i = 0; i < DOWNLOAD_MAX && !d; i++) {
+        if (downloads[i].info.state == DOWNLOAD_RUNNING && downloads[i].req == req) {
+            d = &downloads[i];
+        }
+    }
+    if (!d) return false;
+
+    const GeminiResponse *resp = req->response;
+    char part[sizeof(d->info.path) + 8];
+    part_path(part, sizeof(part), d);
+
+    /* close() can be where a full disk shows up */
+    bool ok = close(d->fd) == 0 && !d->write_errno;
+    if (!ok && !d->write_errno) d->write_errno = errno;
+    d->fd = -1;
+
+    if (!resp) {
+        ok = false;
+        strncpy(d->info.error, "Request failed", sizeof(d->info.error) - 1);
+    }
+    else if (resp->status < 0 || resp->error_msg[0]) {
+        /* Including a body cut short by a failed read */
+        ok = false;
+        const char *why = resp->error_msg[0] ? resp->error_msg : gemini_status_string(resp->status);
+        strncpy(d->info.error, why, sizeof(d->info.error) - 1);
+    }
+    else if (gemini_status_category(resp->status) != 2) {
+        ok = false;
+        snprintf(d->info.error, sizeof(d->info.error), "%s: %.80s",
+                 gemini_status_string(resp->status), resp->meta);
+    }
+    else if (!ok) {
+        snprintf(d->info.error, sizeof(d->info.error), "Could not write: %s",
+                 strerror(d->write_errno));
+    }
+    else if (rename(part, d->info.path) != 0) {
+        ok = false;
+        snprintf(d->info.error, sizeof(d->info.error), "Could not save: %s",
+                 strerror(errno));
+    }
+
+    if (!ok) unlink(part);
+    d->info.state = ok ? DOWNLOAD_DONE : DOWNLOAD_FAILED;
+    d->info.bytes = d->written;
+    d->info.elapsed_ms = SDL_GetTicks() - d->started;
+    d->req = NULL;
+
+    gemini_request_free(req);
+    return true;
+}
+
+void download_cancel(int index) {
+    if (index < 0 || index >= DOWNLOAD_MAX) return;
+
+    Download *d = &downloads[index];
+    if (d->info.state == DOWNLOAD_RUNNING) gemini_fetch_cancel(d->req);
+}
+
+void download_cleanup(void) {
+    for (int i = 0; i < DOWNLOAD_MAX; i++) {
+        Download *d = &downloads[i];
+        if (d->info.state == DOWNLOAD_RUNNING) {
+            char part[sizeof(d->info.path) + 8];
+            part_path(part, sizeof(part), d);
+            close(d->fd);
+            unlink(part);
+        }
+        memset(d, 0, sizeof(*d));
+    }
+}
+
+int download_active(void) {
+    int active = 0;
+    for (int i = 0; i < DOWNLOAD_MAX; i++) {
+        if (downloads[i].info.state == DOWNLOAD_RUNNING) active++;
+    }
+    return active;
+}
+
+bool download_get(int index, DownloadInfo *info) {
+    if (index < 0 || index >= DOWNLOAD_MAX || !info) return false;
+
+    const Download *d = &downloads[index];
+    if (d->info.state == DOWNLOAD_NONE) return false;
+
+    *info = d->info;
+    if (d->info.state == DOWNLOAD_RUNNING) {
+        info->bytes = d->written;
+        info->elapsed_ms = SDL_GetTicks() - d->started;
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+/* Gemini Browser - Saving files that can't be displayed */
+#ifndef PALMINI_DOWNLOAD_H
+#define PALMINI_DOWNLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <SDL.h>
+#include "gemini.h"
+#include "url.h"
+
+#define DOWNLOAD_DIR        "/media/internal/downloads"
+#define DOWNLOAD_MAX        8                   /* Remembered, running or finished */
+#define DOWNLOAD_START_MS   (10 * 60 * 1000)    /* To get the header, queued time included */
+#define DOWNLOAD_IDLE_MS    (2 * 60 * 1000)     /* Without data before it fails */
+
+typedef enum {
+    DOWNLOAD_NONE,
+    DOWNLOAD_RUNNING,
+    DOWNLOAD_DONE,
+    DOWNLOAD_FAILED
+} DownloadState;
+
+typedef struct {
+    DownloadState state;
+    char url[MAX_URL_LENGTH];
+    char path[300];             /* Where the file is saved */
+    char mime[64];
+    size_t bytes;               /* Written so far */
+    Uint32 elapsed_ms;          /* Until now, or until it finished */
+    char error[128];            /* Why it failed */
+} DownloadInfo;
+
+/* All download functions are called from the UI thread. The body is
+ * written to "<path>.part" on the engine thread, a chunk at a time, and
+ * renamed into place once the server has sent all of it. */
+
+/* Set the directory files are saved in, creating it if needed */
+bool download_init(const char *dir);
+
+/* Start saving url, which the server said is of type mime. Returns the
+ * download's index, or -1 if it couldn't be started. */
+int download_start(const Url *url, const char *mime);
+
+/* Handle a finished request. Returns false if req isn't a download, in
+ * which case the caller still owns it. */
+bool download_done(GeminiRequest *req);
+
+/* Stop a running download and delete what it saved */
+void download_cancel(int index);
+
+/* Forget all downloads, deleting partial files. Call after
+ * gemini_cleanup(), once no more data can arrive. */
+void download_cleanup(void);
+
+/* Number of downloads still running */
+int download_active(void);
+
+/* Get a snapshot of download index. Returns false for an unused index. */
+bool download_get(int index, DownloadInfo *info);
+
+#endif /* PALMINI_DOWNLOAD_H */
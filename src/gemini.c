@@ -1,6 +1,12 @@
 /* Gemini Browser - Gemini protocol handler */
 #define _GNU_SOURCE
 #include "gemini.h"
+#include "resolver.h"
+#include "connect.h"
+#include "session_cache.h"
+#include "host_stats.h"
+#include "scheduler.h"
+#include "unreachable.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,11 +15,13 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
-#include <netdb.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <signal.h>
+#include <SDL.h>
+#include <SDL_thread.h>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -26,13 +34,99 @@
 #endif
 
 #define RECV_BUFFER_SIZE 16384
-#define CONNECT_TIMEOUT_SEC 10
-#define RECV_TIMEOUT_SEC 30
+#define CONNECT_TIMEOUT_SEC 10    /* Lookup and connect, within the request's deadline */
 #define MAX_RESPONSE_SIZE (10 * 1024 * 1024)  /* 10 MB max */
+#define ENGINE_MAX_WAIT_MS 1000     /* Longest single poll() */
+#define EVENT_RETRY_MS 10           /* Retry interval while the SDL event queue is full */
+
+/* Largest valid header: two digit status, space, 1024 byte meta, CRLF */
+#define MAX_HEADER_SIZE (2 + 1 + 1024 + 2)
+
+/* Where received bytes land. Streaming reads into a fixed scratch area
+ * that is reused once each chunk has been handed to on_body. A buffered
+ * fetch grows one allocation instead and leaves the body in place behind
+ * the header, so SSL_read writes each byte where resp->body will point
+ * and it is never copied afterwards. */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+    size_t max_body;        /* 0 for a fixed scratch buffer */
+    size_t body_start;      /* Offset of the body, 0 until the header is accepted */
+    bool truncated;
+    unsigned long grows;
+    size_t moved;
+} RecvBuffer;
+
+/* All transfers run on one engine thread that multiplexes every
+ * connection through a single poll(). Each connection is a state machine
+ * that advances while its socket is ready and parks again as soon as
+ * OpenSSL wants to wait for reading or writing. */
+typedef enum {
+    CONN_RESOLVING,
+    CONN_CONNECTING,
+    CONN_HANDSHAKE,
+    CONN_SENDING,
+    CONN_HEADER,
+    CONN_BODY
+} ConnState;
+
+typedef struct GeminiConn {
+    GeminiRequest *req;         /* NULL once delivered */
+    GeminiResponse *resp;
+    ConnState state;
+    ResolveJob *dns;            /* While resolving */
+    ConnectRace race;           /* While connecting */
+    int sock;
+    SSL *ssl;
+    bool offered;               /* A cached session was offered */
+    short events;               /* What the socket waits for */
+    Uint32 deadline;            /* SDL_GetTicks() when the current phase times out */
+    char request[MAX_URL_LENGTH + 4];
+    int request_len;
+    RecvBuffer rb;
+    int first_fd;               /* This connection's entries in the poll set */
+    int nfds;
+    bool paused;                /* Not reading, to leave the radio to a navigation */
+    Uint32 paused_at;           /* SDL_GetTicks() when the pause began */
+    struct GeminiConn *next;
+} GeminiConn;
 
 static SSL_CTX *ssl_ctx = NULL;
 
+static SDL_mutex *engine_lock = NULL;
+static SDL_cond *sync_done = NULL;          /* Broadcast when a blocking fetch finishes */
+static SDL_Thread *engine = NULL;
+static int wake_pipe[2] = { -1, -1 };
+static bool engine_quit = false;
+static GeminiRequest *submitted = NULL;     /* Not yet picked up by the engine */
+static GeminiRequest *completed = NULL;     /* Waiting for gemini_take_completed() */
+static GeminiRequest *completed_tail = NULL;
+static bool completed_notified = false;     /* A wake-up event is outstanding */
+static GeminiEngineStats engine_stats;
+static volatile bool fast_open = false;     /* See gemini_set_fast_open() */
+static GeminiRecvStats recv_stats;
+
+/* Engine thread only */
+static GeminiConn *conns = NULL;
+
+static int engine_thread(void *data);
+
+/* Interrupt the engine's poll() */
+static void engine_wake(void) {
+    if (wake_pipe[1] < 0) return;
+
+    /* A full pipe already guarantees a wake-up */
+    char c = 0;
+    ssize_t n = write(wake_pipe[1], &c, 1);
+    (void)n;
+}
+
 bool gemini_init(void) {
+    /* Writes on a socket the server has closed must fail with EPIPE
+     * rather than kill the process */
+    signal(SIGPIPE, SIG_IGN);
+
     /* Initialize OpenSSL */
     SSL_library_init();
     SSL_load_error_strings();
@@ -49,14 +143,94 @@ bool gemini_init(void) {
     /* Note: The 0.9.8 headers don't have SSL_OP_NO_TLSv1_1, but the runtime
      * (OpenSSL 1.0.2p) will negotiate up to TLS 1.2 automatically */
     SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    /* Newer OpenSSL reports a close without close_notify as an error.
+     * Plenty of servers do that; treat it as the end of the body, as
+     * older versions did. */
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
 
     /* TOFU model - don't verify certificates */
     SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
 
+    /* DNS lookups run on their own threads so they can time out */
+    if (!resolver_init()) {
+        fprintf(stderr, "Failed to start resolver\n");
+        SSL_CTX_free(ssl_ctx);
+        ssl_ctx = NULL;
+        return false;
+    }
+
+    /* Resumption avoids a full handshake on repeat visits */
+    if (!session_cache_init(SESSION_CACHE_FILE)) {
+        fprintf(stderr, "Failed to initialize TLS session cache\n");
+    }
+    if (!host_stats_init(HOST_STATS_FILE)) {
+        fprintf(stderr, "Failed to initialize host statistics\n");
+    }
+    if (!unreachable_init()) {
+        fprintf(stderr, "Failed to initialize unreachable host cache\n");
+    }
+
+    engine_lock = SDL_CreateMutex();
+    sync_done = SDL_CreateCond();
+    if (!engine_lock || !sync_done || !scheduler_init() || pipe(wake_pipe) != 0) {
+        fprintf(stderr, "Failed to set up fetch engine\n");
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(wake_pipe[i], F_SETFL, fcntl(wake_pipe[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    /* Finished lookups wake the engine to start connecting */
+    resolver_set_notify(engine_wake);
+
+    engine_quit = false;
+    memset(&engine_stats, 0, sizeof(engine_stats));
+    engine = SDL_CreateThread(engine_thread, NULL);
+    if (!engine) {
+        fprintf(stderr, "Failed to start fetch engine\n");
+        return false;
+    }
+
     return true;
 }
 
 void gemini_cleanup(void) {
+    /* Stop the engine, which cancels whatever is still in flight */
+    if (engine) {
+        SDL_LockMutex(engine_lock);
+        engine_quit = true;
+        SDL_UnlockMutex(engine_lock);
+        engine_wake();
+        SDL_WaitThread(engine, NULL);
+        engine = NULL;
+    }
+
+    /* Nobody is left to take these */
+    while (completed) {
+        GeminiRequest *req = completed;
+        completed = req->next;
+        gemini_request_free(req);
+    }
+    completed_tail = NULL;
+
+    resolver_set_notify(NULL);
+    for (int i = 0; i < 2; i++) {
+        if (wake_pipe[i] >= 0) close(wake_pipe[i]);
+        wake_pipe[i] = -1;
+    }
+    if (sync_done) SDL_DestroyCond(sync_done);
+    if (engine_lock) SDL_DestroyMutex(engine_lock);
+    sync_done = NULL;
+    engine_lock = NULL;
+
+    scheduler_cleanup();
+    session_cache_cleanup();
+    host_stats_cleanup();
+    unreachable_cleanup();
+    resolver_cleanup();
+
     if (ssl_ctx) {
         SSL_CTX_free(ssl_ctx);
         ssl_ctx = NULL;
@@ -65,267 +239,1094 @@ void gemini_cleanup(void) {
     ERR_free_strings();
 }
 
-static int connect_with_timeout(const char *host, uint16_t port, int timeout_sec) {
-    struct addrinfo hints, *res, *rp;
-    int sock = -1;
-    char port_str[8];
+void gemini_persist(void) {
+    session_cache_save();
+    host_stats_save();
+}
 
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
+/* Parse "<status> <meta>" from a header line of header_len bytes (CRLF
+ * excluded) into resp. Returns false if the line is malformed. */
+static bool parse_header(const char *line, size_t header_len, GeminiResponse *resp) {
+    /* Parse status code (first two digits) */
+    if (header_len < 2 || !isdigit((unsigned char)line[0]) || !isdigit((unsigned char)line[1])) {
+        resp->status = GM_STATUS_ERROR_HEADER;
+        strncpy(resp->error_msg, "Invalid status code", sizeof(resp->error_msg) - 1);
+        return false;
+    }
+
+    resp->status = (line[0] - '0') * 10 + (line[1] - '0');
+
+    /* Parse meta (everything after status and space until CRLF) */
+    const char *meta_start = line + 2;
+    const char *header_end = line + header_len;
+    if (meta_start < header_end && *meta_start == ' ') meta_start++;
+    size_t meta_len = header_end - meta_start;
+    if (meta_len >= sizeof(resp->meta)) meta_len = sizeof(resp->meta) - 1;
+    memcpy(resp->meta, meta_start, meta_len);
+    resp->meta[meta_len] = '\0';
+    return true;
+}
 
-    snprintf(port_str, sizeof(port_str), "%d", port);
+/* Free space at the end of rb, growing it if it may grow. A growing
+ * buffer keeps a byte spare for the terminator. Returns 0 when full. */
+static size_t recv_space(RecvBuffer *rb) {
+    if (!rb->max_body) return rb->capacity - rb->len;
 
-    int err = getaddrinfo(host, port_str, &hints, &res);
-    if (err != 0) {
-        return -1;
+    size_t limit = (rb->body_start ? rb->body_start : MAX_HEADER_SIZE) + rb->max_body + 1;
+    if (rb->len + 1 >= rb->capacity && rb->capacity < limit) {
+        size_t new_capacity = rb->capacity ? rb->capacity * 2 : RECV_BUFFER_SIZE;
+        if (new_capacity > limit) new_capacity = limit;
+        char *new_data = realloc(rb->data, new_capacity);
+        if (!new_data) return 0;
+        if (rb->data && new_data != rb->data) rb->moved += rb->len;
+        rb->data = new_data;
+        rb->capacity = new_capacity;
+        rb->grows++;
     }
+    return rb->len + 1 < rb->capacity ? rb->capacity - rb->len - 1 : 0;
+}
 
-    for (rp = res; rp != NULL; rp = rp->ai_next) {
-        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (sock < 0) continue;
+static void recv_account(const RecvBuffer *rb, size_t received) {
+    __sync_fetch_and_add(&recv_stats.fetches, 1);
+    __sync_fetch_and_add(&recv_stats.received, received);
+    __sync_fetch_and_add(&recv_stats.moved, rb->moved);
+    __sync_fetch_and_add(&recv_stats.grows, rb->grows);
 
-        /* Set non-blocking for timeout */
-        int flags = fcntl(sock, F_GETFL, 0);
-        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    size_t peak = recv_stats.peak_buffer;
+    while (rb->capacity > peak &&
+           !__sync_bool_compare_and_swap(&recv_stats.peak_buffer, peak, rb->capacity)) {
+        peak = recv_stats.peak_buffer;
+    }
+}
 
-        int ret = connect(sock, rp->ai_addr, rp->ai_addrlen);
-        if (ret < 0 && errno != EINPROGRESS) {
-            close(sock);
-            sock = -1;
-            continue;
+static bool text_only_on_header(const GeminiResponse *resp, void *userdata) {
+    (void)userdata;
+    if (gemini_status_category(resp->status) == 2) {
+        /* Empty meta defaults to text/gemini */
+        if (resp->meta[0] && strncmp(resp->meta, "text/", 5) != 0) {
+            return false;
         }
+    }
+    return true;
+}
 
-        if (ret < 0) {
-            /* Wait for connection with timeout */
-            fd_set wfds;
-            struct timeval tv;
-            FD_ZERO(&wfds);
-            FD_SET(sock, &wfds);
-            tv.tv_sec = timeout_sec;
-            tv.tv_usec = 0;
-
-            ret = select(sock + 1, NULL, &wfds, NULL, &tv);
-            if (ret <= 0) {
-                close(sock);
-                sock = -1;
-                continue;
-            }
+static const GeminiStreamHandler text_only_handler = { text_only_on_header, NULL };
+
+/* Cancelled directly or through its token */
+static bool request_cancelled(const GeminiRequest *req) {
+    return req->cancelled || (req->token && req->token->fired);
+}
 
-            /* Check if connect succeeded */
-            int error;
-            socklen_t len = sizeof(error);
-            if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error) {
-                close(sock);
-                sock = -1;
-                continue;
+/* The handler a connection reports to: the caller's when streaming */
+static const GeminiStreamHandler *conn_handler(const GeminiConn *c) {
+    if (c->req->handler) return c->req->handler;
+    return (c->req->flags & GEMINI_FETCH_TEXT_ONLY) ? &text_only_handler : NULL;
+}
+
+/* Timestamp for GeminiTrace, where 0 means "not reached" */
+static Uint32 trace_now(void) {
+    Uint32 now = SDL_GetTicks();
+    return now ? now : 1;
+}
+
+/* Hand a finished request to whoever is waiting for it */
+static void request_deliver(GeminiRequest *req) {
+    SDL_LockMutex(engine_lock);
+    req->finished = 1;
+    if (req->sync) {
+        SDL_CondBroadcast(sync_done);
+    }
+    else {
+        req->next = NULL;
+        if (completed_tail) {
+            completed_tail->next = req;
+        }
+        else {
+            completed = req;
+        }
+        completed_tail = req;
+    }
+    engine_stats.completed++;
+    engine_stats.active--;
+    SDL_UnlockMutex(engine_lock);
+}
+
+/* Post the wake-up event if the queue holds requests the caller hasn't
+ * been told about. Returns false if the SDL event queue was full. */
+static bool notify_completed(void) {
+    SDL_LockMutex(engine_lock);
+    bool post = completed && !completed_notified;
+    if (post) completed_notified = true;
+    SDL_UnlockMutex(engine_lock);
+    if (!post) return true;
+
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = SDL_USEREVENT;
+    event.user.code = GEMINI_EVENT_FETCH_DONE;
+    if (SDL_PushEvent(&event) == 0) return true;
+
+    SDL_LockMutex(engine_lock);
+    completed_notified = false;
+    SDL_UnlockMutex(engine_lock);
+    return false;
+}
+
+/* Release everything the connection holds. A connection that completed
+ * its handshake saves its session first; this happens at the end rather
+ * than after the handshake because TLS 1.3 servers send their session
+ * tickets later. */
+static void conn_close(GeminiConn *c, bool save_session) {
+    if (c->dns) {
+        resolver_abandon(c->dns, false);
+        c->dns = NULL;
+    }
+    if (c->state == CONN_CONNECTING) {
+        connect_race_abort(&c->race);
+    }
+    if (c->ssl) {
+        if (save_session) {
+            session_cache_store(c->ssl, c->req->url.host, c->req->url.port, c->offered);
+            SSL_shutdown(c->ssl);
+        }
+        SSL_free(c->ssl);
+        c->ssl = NULL;
+    }
+    if (c->sock >= 0) {
+        close(c->sock);
+        c->sock = -1;
+    }
+}
+
+/* Finish the transfer: close it, attach the body and deliver the request.
+ * The connection is freed by the engine loop afterwards. */
+static void conn_complete(GeminiConn *c) {
+    bool handshake_done = c->state >= CONN_SENDING;
+    conn_close(c, handshake_done && !request_cancelled(c->req));
+
+    RecvBuffer *rb = &c->rb;
+    GeminiResponse *resp = c->resp;
+    if (resp) resp->trace.done = trace_now();
+    if (request_cancelled(c->req) && resp) {
+        resp->status = GM_STATUS_ERROR_CANCELLED;
+        resp->meta[0] = '\0';
+        strncpy(resp->error_msg, "Request cancelled", sizeof(resp->error_msg) - 1);
+    }
+
+    if (rb->max_body) {
+        size_t received = rb->len;
+        bool has_body = resp && resp->status >= 10 && rb->body_start && rb->len > rb->body_start;
+        if (has_body) {
+            /* Give back the unused tail of the last doubling. Shrinking
+             * happens in place, so the body stays where it was read. */
+            char *data = realloc(rb->data, rb->len + 1);
+            if (data) {
+                if (data != rb->data) rb->moved += rb->len;
+                rb->data = data;
             }
+            rb->data[rb->len] = '\0';
+            resp->body_base = rb->data;
+            resp->body = rb->data + rb->body_start;
+            resp->body_len = rb->len - rb->body_start;
+            resp->truncated = rb->truncated;
+            rb->data = NULL;
         }
+        recv_account(rb, received);
+    }
+    free(rb->data);
+    rb->data = NULL;
 
-        /* Restore blocking mode */
-        fcntl(sock, F_SETFL, flags);
-        break;
+    GeminiRequest *req = c->req;
+    host_stats_record(req->url.host, resp);
+    c->resp = NULL;
+    c->req = NULL;
+    if (scheduler_finished(req, resp)) {
+        /* It will be sent again - nobody needs this attempt's answer */
+        gemini_response_free(resp);
+        return;
     }
+    req->response = resp;
+    request_deliver(req);
+}
 
-    freeaddrinfo(res);
-    return sock;
+static void conn_fail(GeminiConn *c, GeminiStatus status, const char *msg) {
+    if (c->resp) {
+        c->resp->status = status;
+        strncpy(c->resp->error_msg, msg, sizeof(c->resp->error_msg) - 1);
+    }
+    conn_complete(c);
 }
 
-GeminiResponse *gemini_fetch(const Url *url) {
-    GeminiResponse *resp = calloc(1, sizeof(GeminiResponse));
-    if (!resp) return NULL;
+static void conn_handshake(GeminiConn *c);
+static void conn_send(GeminiConn *c);
+static void conn_receive(GeminiConn *c);
 
-    if (!ssl_ctx) {
-        resp->status = GM_STATUS_ERROR_TLS;
-        strncpy(resp->error_msg, "SSL not initialized", sizeof(resp->error_msg) - 1);
-        return resp;
+/* A connection won the race - start TLS on it */
+static void conn_connected(GeminiConn *c, int sock) {
+    resolver_set_preferred_family(c->req->url.host, connect_race_family(&c->race));
+    unreachable_clear(c->req->url.host, c->req->url.port);
+    c->sock = sock;
+    c->resp->trace.connected = trace_now();
+
+    c->ssl = SSL_new(ssl_ctx);
+    if (!c->ssl) {
+        c->state = CONN_HANDSHAKE;
+        conn_fail(c, GM_STATUS_ERROR_TLS, "Failed to create SSL object");
+        return;
     }
 
-    if (!url_is_gemini(url)) {
-        resp->status = GM_STATUS_ERROR_CONNECT;
-        snprintf(resp->error_msg, sizeof(resp->error_msg),
-                 "Unsupported protocol: %s", url->scheme);
-        return resp;
+    SSL_set_fd(c->ssl, sock);
+    SSL_set_tlsext_host_name(c->ssl, c->req->url.host);
+    c->offered = session_cache_apply(c->ssl, c->req->url.host, c->req->url.port);
+
+    /* The rest of the request runs against its own deadline */
+    c->state = CONN_HANDSHAKE;
+    c->deadline = c->req->deadline;
+    conn_handshake(c);
+}
+
+static void conn_connect_step(GeminiConn *c, const struct pollfd *fds, int nfds) {
+    int sock = connect_race_step(&c->race, fds, nfds);
+    if (sock == -1) return;
+
+    if (sock == -2) {
+        unreachable_mark(c->req->url.host, c->req->url.port, UNREACHABLE_REFUSED);
+        char msg[sizeof(c->resp->error_msg)];
+        snprintf(msg, sizeof(msg), "Could not connect to %s:%d", c->req->url.host, c->req->url.port);
+        conn_fail(c, GM_STATUS_ERROR_CONNECT, msg);
+        return;
     }
+    conn_connected(c, sock);
+}
 
-    /* Connect to server */
-    int sock = connect_with_timeout(url->host, url->port, CONNECT_TIMEOUT_SEC);
-    if (sock < 0) {
-        resp->status = GM_STATUS_ERROR_CONNECT;
-        snprintf(resp->error_msg, sizeof(resp->error_msg),
-                 "Could not connect to %s:%d", url->host, url->port);
-        return resp;
+/* Addresses are known - race connections to them */
+static void conn_resolved(GeminiConn *c, const ResolvedAddrs *addrs) {
+    c->resp->trace.resolved = trace_now();
+    c->state = CONN_CONNECTING;
+    bool tfo = fast_open && host_stats_fast_open_allowed(c->req->url.host);
+    connect_race_start(&c->race, addrs, c->req->url.port, tfo);
+    conn_connect_step(c, NULL, 0);
+}
+
+/* Map an OpenSSL result that didn't complete to what to wait for.
+ * Returns false if it is a real error or EOF. Every connection shares
+ * this thread's error queue, so each SSL call must start with it empty. */
+static bool conn_should_wait(GeminiConn *c, int ret) {
+    int err = SSL_get_error(c->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ) {
+        c->events = POLLIN;
+        return true;
+    }
+    if (err == SSL_ERROR_WANT_WRITE) {
+        c->events = POLLOUT;
+        return true;
     }
+    return false;
+}
 
-    /* Create SSL connection */
-    SSL *ssl = SSL_new(ssl_ctx);
-    if (!ssl) {
-        close(sock);
-        resp->status = GM_STATUS_ERROR_TLS;
-        strncpy(resp->error_msg, "Failed to create SSL object", sizeof(resp->error_msg) - 1);
-        return resp;
+/* How TCP Fast Open went, once the handshake is over */
+static void conn_fast_open_done(GeminiConn *c, bool ok) {
+    if (!c->race.fast_open) return;
+
+    HostFastOpen outcome;
+    if (!c->race.deferred) {
+        outcome = HOST_FAST_OPEN_COOKIE;
     }
+    else if (!ok) {
+        outcome = HOST_FAST_OPEN_FAILED;
+    }
+    else {
+        outcome = connect_syn_data_acked(c->sock) ? HOST_FAST_OPEN_ACCEPTED
+                                                  : HOST_FAST_OPEN_IGNORED;
+    }
+    host_stats_record_fast_open(c->req->url.host, outcome);
+    c->race.fast_open = false;
+}
 
-    SSL_set_fd(ssl, sock);
-    SSL_set_tlsext_host_name(ssl, url->host);
+static void conn_handshake(GeminiConn *c) {
+    ERR_clear_error();
+    int ret = SSL_connect(c->ssl);
+    if (ret > 0) {
+        conn_fast_open_done(c, true);
+        GeminiTrace *trace = &c->resp->trace;
+        trace->handshaken = trace_now();
+        strncpy(trace->tls_version, SSL_get_version(c->ssl), sizeof(trace->tls_version) - 1);
+        strncpy(trace->tls_cipher, SSL_get_cipher_name(c->ssl), sizeof(trace->tls_cipher) - 1);
+        trace->tls_resumed = SSL_session_reused(c->ssl) != 0;
 
-    if (SSL_connect(ssl) <= 0) {
-        unsigned long err = ERR_get_error();
-        char err_buf[256];
-        ERR_error_string_n(err, err_buf, sizeof(err_buf));
-        SSL_free(ssl);
-        close(sock);
-        resp->status = GM_STATUS_ERROR_TLS;
-        snprintf(resp->error_msg, sizeof(resp->error_msg),
-                 "TLS handshake failed: %s", err_buf);
-        return resp;
+        snprintf(c->request, sizeof(c->request), "%s\r\n", c->req->url.full);
+        c->request_len = strlen(c->request);
+        c->state = CONN_SENDING;
+        conn_send(c);
+        return;
     }
+    if (conn_should_wait(c, ret)) return;
 
-    /* Send request: URL + CRLF */
-    char request[MAX_URL_LENGTH + 4];
-    snprintf(request, sizeof(request), "%s\r\n", url->full);
-
-    int sent = SSL_write(ssl, request, strlen(request));
-    if (sent <= 0) {
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        close(sock);
-        resp->status = GM_STATUS_ERROR_SEND;
-        strncpy(resp->error_msg, "Failed to send request", sizeof(resp->error_msg) - 1);
-        return resp;
+    /* Don't offer a session that may have caused the failure again */
+    if (c->offered) session_cache_remove(c->req->url.host, c->req->url.port);
+    conn_fast_open_done(c, false);
+
+    unsigned long err = ERR_get_error();
+    char err_buf[256];
+    ERR_error_string_n(err, err_buf, sizeof(err_buf));
+    char msg[sizeof(c->resp->error_msg)];
+    snprintf(msg, sizeof(msg), "TLS handshake failed: %s", err_buf);
+    conn_fail(c, GM_STATUS_ERROR_TLS, msg);
+}
+
+static void conn_send(GeminiConn *c) {
+    /* Without partial writes, SSL_write sends all of it or asks to be
+     * called again with the same arguments */
+    ERR_clear_error();
+    int ret = SSL_write(c->ssl, c->request, c->request_len);
+    if (ret > 0) {
+        c->resp->trace.sent = trace_now();
+        c->state = CONN_HEADER;
+        conn_receive(c);
+        return;
     }
+    if (conn_should_wait(c, ret)) return;
 
-    /* Receive response */
-    char buffer[RECV_BUFFER_SIZE];
-    size_t total_size = 0;
-    size_t capacity = RECV_BUFFER_SIZE;
-    char *data = malloc(capacity);
-    if (!data) {
-        SSL_shutdown(ssl);
-        SSL_free(ssl);
-        close(sock);
-        resp->status = GM_STATUS_ERROR_MEMORY;
-        strncpy(resp->error_msg, "Out of memory", sizeof(resp->error_msg) - 1);
-        return resp;
+    conn_fail(c, GM_STATUS_ERROR_SEND, "Failed to send request");
+}
+
+/* Look for the end of the header among the bytes read so far, starting
+ * at scan. Returns false once the transfer is over. */
+static bool conn_got_header_bytes(GeminiConn *c, size_t scan) {
+    RecvBuffer *rb = &c->rb;
+    size_t header_len = 0;
+    bool have_header = false;
+
+    /* Find end of header line (CRLF), rescanning one byte for a split pair */
+    for (size_t i = scan; i + 1 < rb->len; i++) {
+        if (rb->data[i] == '\r' && rb->data[i + 1] == '\n') {
+            header_len = i;
+            have_header = true;
+            break;
+        }
     }
 
-    /* Set socket timeout for receive */
-    struct timeval tv;
-    tv.tv_sec = RECV_TIMEOUT_SEC;
-    tv.tv_usec = 0;
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (!have_header) {
+        if (rb->len < MAX_HEADER_SIZE) return true;
+        c->resp->status = GM_STATUS_ERROR_HEADER;
+        strncpy(c->resp->error_msg, "Malformed response header", sizeof(c->resp->error_msg) - 1);
+        return false;
+    }
+
+    if (!parse_header(rb->data, header_len, c->resp)) return false;
+
+    const GeminiStreamHandler *handler = conn_handler(c);
+    void *userdata = c->req->handler_data;
+    if (handler && handler->on_header && !handler->on_header(c->resp, userdata)) {
+        return false;
+    }
+
+    size_t body_start = header_len + 2;
+    c->state = CONN_BODY;
+    if (rb->max_body) {
+        rb->body_start = body_start;
+
+        /* The header read may already have brought in more than is allowed */
+        if (rb->len - body_start > rb->max_body) {
+            rb->len = body_start + rb->max_body;
+            rb->truncated = true;
+            return false;
+        }
+        return true;
+    }
+
+    /* Hand over whatever body bytes arrived with the header, then stream */
+    bool more = true;
+    if (rb->len > body_start && handler && handler->on_body) {
+        more = handler->on_body(rb->data + body_start, rb->len - body_start, userdata);
+    }
+    rb->len = 0;
+    return more;
+}
+
+/* The server closed the connection, or the read failed. ret and
+ * read_errno are what SSL_read() left behind. */
+static void conn_end_of_stream(GeminiConn *c, int ret, int read_errno) {
+    if (c->state == CONN_HEADER) {
+        c->resp->status = GM_STATUS_ERROR_HEADER;
+        strncpy(c->resp->error_msg,
+                c->rb.len < 3 ? "Response too short" : "Malformed response header",
+                sizeof(c->resp->error_msg) - 1);
+        conn_complete(c);
+        return;
+    }
+
+    /* Only a close_notify or a bare EOF ends the body; anything else
+     * cut it short and must not pass for the whole of it */
+    int err = SSL_get_error(c->ssl, ret);
+    if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && read_errno == 0)) {
+        conn_complete(c);
+        return;
+    }
+
+    char msg[sizeof(c->resp->error_msg)];
+    if (err == SSL_ERROR_SYSCALL) {
+        snprintf(msg, sizeof(msg), "Connection to %s lost: %s",
+                 c->req->url.host, strerror(read_errno));
+    }
+    else {
+        char err_buf[128];
+        ERR_error_string_n(ERR_get_error(), err_buf, sizeof(err_buf));
+        snprintf(msg, sizeof(msg), "Reading from %s failed: %s", c->req->url.host, err_buf);
+    }
+    conn_fail(c, GM_STATUS_ERROR_RECV, msg);
+}
+
+/* Read until OpenSSL runs dry, the body is complete or its limit is hit */
+static void conn_receive(GeminiConn *c) {
+    RecvBuffer *rb = &c->rb;
+    for (;;) {
+        char probe;
+        char *dst;
+        size_t space;
+
+        if (c->state == CONN_BODY && rb->max_body &&
+            rb->len - rb->body_start >= rb->max_body) {
+            /* Full - anything further means the body was cut short */
+            dst = &probe;
+            space = 1;
+        }
+        else {
+            space = recv_space(rb);
+            if (space == 0) {
+                conn_complete(c);
+                return;
+            }
+            if (c->state == CONN_BODY && rb->max_body &&
+                space > rb->max_body - (rb->len - rb->body_start)) {
+                space = rb->max_body - (rb->len - rb->body_start);
+            }
+            dst = rb->data + rb->len;
+        }
 
-    while (1) {
-        int received = SSL_read(ssl, buffer, sizeof(buffer));
+        ERR_clear_error();
+        errno = 0;
+        int received = SSL_read(c->ssl, dst, space);
+        int read_errno = errno;
         if (received <= 0) {
-            int err = SSL_get_error(ssl, received);
-            if (err == SSL_ERROR_ZERO_RETURN) {
-                break;  /* Clean shutdown */
+            if (conn_should_wait(c, received)) return;
+            conn_end_of_stream(c, received, read_errno);
+            return;
+        }
+
+        if (dst == &probe) {
+            rb->truncated = true;
+            conn_complete(c);
+            return;
+        }
+
+        if (!c->resp->trace.first_byte) c->resp->trace.first_byte = trace_now();
+        c->resp->trace.received += received;
+
+        size_t scan = rb->len > 0 ? rb->len - 1 : 0;
+        rb->len += received;
+
+        bool more = true;
+        if (c->state == CONN_HEADER) {
+            more = conn_got_header_bytes(c, scan);
+        }
+        else if (!rb->max_body) {
+            const GeminiStreamHandler *handler = conn_handler(c);
+            if (handler && handler->on_body) {
+                more = handler->on_body(rb->data, rb->len, c->req->handler_data);
             }
-            else if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-                continue;  /* Retry */
+            rb->len = 0;
+        }
+        if (!more) {
+            conn_complete(c);
+            return;
+        }
+
+        /* A body with an idle timeout only fails when it stalls */
+        if (c->state == CONN_BODY && c->req->idle_timeout) {
+            c->deadline = SDL_GetTicks() + c->req->idle_timeout;
+        }
+    }
+}
+
+/* Start a request the scheduler released */
+static void conn_start(GeminiRequest *req, SchedulerVerdict verdict) {
+    GeminiConn *c = calloc(1, sizeof(GeminiConn));
+    GeminiResponse *resp = calloc(1, sizeof(GeminiResponse));
+    char *scratch = req->handler ? malloc(RECV_BUFFER_SIZE) : NULL;
+    if (!c || !resp || (req->handler && !scratch)) {
+        /* Report it the way an out-of-memory fetch always has: no response */
+        free(c);
+        free(resp);
+        free(scratch);
+        scheduler_finished(req, NULL);
+        request_deliver(req);
+        return;
+    }
+
+    c->req = req;
+    c->resp = resp;
+    c->sock = -1;
+    c->state = CONN_RESOLVING;
+    if (scratch) {
+        c->rb.data = scratch;
+        c->rb.capacity = RECV_BUFFER_SIZE;
+    }
+    else {
+        c->rb.max_body = (req->flags & GEMINI_FETCH_SMALL) ? GEMINI_SMALL_BODY_MAX
+                                                           : MAX_RESPONSE_SIZE;
+    }
+    c->next = conns;
+    conns = c;
+
+    if (request_cancelled(req)) {
+        conn_complete(c);
+        return;
+    }
+    if (verdict == SCHEDULER_EXPIRED) {
+        char msg[sizeof(resp->error_msg)];
+        snprintf(msg, sizeof(msg), "Gave up waiting to connect to %s", req->url.host);
+        conn_fail(c, GM_STATUS_ERROR_TIMEOUT, msg);
+        return;
+    }
+    if (verdict == SCHEDULER_BACKED_OFF) {
+        char msg[sizeof(resp->error_msg)];
+        snprintf(msg, sizeof(msg), "%s asked to slow down for longer than the request may take",
+                 req->url.host);
+        conn_fail(c, GM_STATUS_SLOW_DOWN, msg);
+        return;
+    }
+
+    if (!ssl_ctx) {
+        conn_fail(c, GM_STATUS_ERROR_TLS, "SSL not initialized");
+        return;
+    }
+
+    if (!url_is_gemini(&req->url)) {
+        char msg[sizeof(resp->error_msg)];
+        snprintf(msg, sizeof(msg), "Unsupported protocol: %s", req->url.scheme);
+        conn_fail(c, GM_STATUS_ERROR_CONNECT, msg);
+        return;
+    }
+
+    /* Don't sit through the connect timeout again for a host that just failed */
+    UnreachableReason reason;
+    Uint32 remaining;
+    if (unreachable_check(req->url.host, req->url.port, &reason, &remaining)) {
+        char msg[sizeof(resp->error_msg)];
+        snprintf(msg, sizeof(msg), "%s was unreachable (%s). Open it again to retry now, "
+                 "or wait %lu s.", req->url.host, unreachable_reason_name(reason),
+                 (unsigned long)(remaining + 999) / 1000);
+        conn_fail(c, GM_STATUS_ERROR_UNREACHABLE, msg);
+        return;
+    }
+
+    /* Everything before this was answered without the network */
+    resp->trace.start = trace_now();
+
+    /* The lookup runs on a resolver thread and shares the connect budget */
+    c->deadline = SDL_GetTicks() + CONNECT_TIMEOUT_SEC * 1000;
+    if ((Sint32)(req->deadline - c->deadline) < 0) c->deadline = req->deadline;
+    ResolvedAddrs addrs;
+    ResolveResult dns = resolver_start(req->url.host, &addrs, &c->dns);
+    if (dns == RESOLVE_OK) {
+        conn_resolved(c, &addrs);
+    }
+    else if (dns != RESOLVE_PENDING) {
+        char msg[sizeof(resp->error_msg)];
+        snprintf(msg, sizeof(msg), "Could not resolve %s", req->url.host);
+        conn_fail(c, GM_STATUS_ERROR_CONNECT, msg);
+    }
+}
+
+/* The current phase ran out of time */
+static void conn_timed_out(GeminiConn *c) {
+    const GeminiRequest *req = c->req;
+    char msg[sizeof(c->resp->error_msg)];
+
+    /* Only a lookup or connect that had its full budget says the host is
+     * unreachable, not one cut short by the request's own deadline */
+    if ((c->state == CONN_RESOLVING || c->state == CONN_CONNECTING) &&
+        c->deadline != req->deadline) {
+        unreachable_mark(req->url.host, req->url.port, UNREACHABLE_TIMEOUT);
+    }
+
+    switch (c->state) {
+        case CONN_RESOLVING:
+            resolver_abandon(c->dns, true);
+            c->dns = NULL;
+            snprintf(msg, sizeof(msg), "DNS lookup for %s timed out", req->url.host);
+            break;
+        case CONN_CONNECTING:
+            snprintf(msg, sizeof(msg), "Connecting to %s:%d timed out", req->url.host, req->url.port);
+            break;
+        case CONN_HANDSHAKE:
+            conn_fast_open_done(c, false);
+            snprintf(msg, sizeof(msg), "TLS handshake with %s timed out", req->url.host);
+            break;
+        case CONN_SENDING:
+            snprintf(msg, sizeof(msg), "Sending the request to %s timed out", req->url.host);
+            break;
+        case CONN_HEADER:
+            snprintf(msg, sizeof(msg), "No response from %s in time", req->url.host);
+            break;
+        case CONN_BODY:
+            if (req->idle_timeout) {
+                snprintf(msg, sizeof(msg), "%s stopped sending", req->url.host);
             }
             else {
-                break;  /* Error or EOF */
+                snprintf(msg, sizeof(msg), "Response from %s not complete in time", req->url.host);
             }
+            break;
+    }
+    conn_fail(c, GM_STATUS_ERROR_TIMEOUT, msg);
+}
+
+/* Work that doesn't wait on the connection's own socket: cancellation,
+ * timeouts, finished lookups, due connection attempts and pausing */
+static void conn_check(GeminiConn *c) {
+    if (request_cancelled(c->req)) {
+        conn_complete(c);
+        return;
+    }
+
+    /* A paused body transfer stops being read, so TCP flow control
+     * slows the server down until the navigation is done */
+    scheduler_reprioritize(c->req);
+    bool pause = c->state == CONN_BODY && scheduler_should_yield(c->req->priority);
+    if (pause && !c->paused) {
+        c->paused_at = SDL_GetTicks();
+        SDL_LockMutex(engine_lock);
+        engine_stats.pauses++;
+        SDL_UnlockMutex(engine_lock);
+    } else if (!pause && c->paused) {
+        /* Time spent paused was the navigation's, not this transfer's */
+        Uint32 paused_for = SDL_GetTicks() - c->paused_at;
+        c->deadline += paused_for;
+        c->req->deadline += paused_for;
+    }
+    c->paused = pause;
+
+    if (c->state == CONN_RESOLVING) {
+        ResolvedAddrs addrs;
+        ResolveResult dns = resolver_poll(c->dns, &addrs);
+        if (dns == RESOLVE_OK) {
+            c->dns = NULL;
+            conn_resolved(c, &addrs);
+            return;
         }
+        if (dns == RESOLVE_FAILED) {
+            c->dns = NULL;
+            unreachable_mark(c->req->url.host, c->req->url.port, UNREACHABLE_DNS);
+            char msg[sizeof(c->resp->error_msg)];
+            snprintf(msg, sizeof(msg), "Could not resolve %s", c->req->url.host);
+            conn_fail(c, GM_STATUS_ERROR_CONNECT, msg);
+            return;
+        }
+    }
+
+    if (!c->paused && (Sint32)(SDL_GetTicks() - c->deadline) >= 0) {
+        conn_timed_out(c);
+        return;
+    }
+
+    if (c->state == CONN_CONNECTING) conn_connect_step(c, NULL, 0);
+}
+
+/* Add the connection's sockets to the poll set. Returns the count. */
+static int conn_pollfds(const GeminiConn *c, struct pollfd *fds) {
+    if (c->paused) return 0;
+
+    switch (c->state) {
+        case CONN_RESOLVING:
+            return 0;
+        case CONN_CONNECTING:
+            return connect_race_pollfds(&c->race, fds, RESOLVER_MAX_ADDRS);
+        default:
+            fds[0].fd = c->sock;
+            fds[0].events = c->events;
+            fds[0].revents = 0;
+            return 1;
+    }
+}
+
+/* Milliseconds until the connection needs attention without I/O */
+static int conn_timeout(const GeminiConn *c) {
+    if (c->paused) return ENGINE_MAX_WAIT_MS;  /* The deadline is stopped */
+
+    Sint32 remaining = (Sint32)(c->deadline - SDL_GetTicks());
+    int wait = remaining > 0 ? remaining : 0;
+    if (c->state == CONN_CONNECTING) {
+        int next = connect_race_timeout(&c->race);
+        if (next >= 0 && next < wait) wait = next;
+    }
+    return wait;
+}
+
+/* Advance the connection after poll() */
+static void conn_step(GeminiConn *c, const struct pollfd *fds, int nfds) {
+    bool ready = false;
+    for (int i = 0; i < nfds; i++) {
+        if (fds[i].revents) ready = true;
+    }
+    if (!ready) return;
+
+    switch (c->state) {
+        case CONN_CONNECTING: conn_connect_step(c, fds, nfds); break;
+        case CONN_HANDSHAKE:  conn_handshake(c); break;
+        case CONN_SENDING:    conn_send(c); break;
+        case CONN_HEADER:
+        case CONN_BODY:       conn_receive(c); break;
+        default:              break;
+    }
+}
+
+/* Free delivered connections */
+static void reap_conns(void) {
+    GeminiConn **pp = &conns;
+    while (*pp) {
+        GeminiConn *c = *pp;
+        if (c->req) {
+            pp = &c->next;
+            continue;
+        }
+        *pp = c->next;
+        gemini_response_free(c->resp);
+        free(c);
+    }
+}
+
+static int engine_thread(void *data) {
+    (void)data;
+    struct pollfd *fds = NULL;
+    int fds_capacity = 0;
 
-        /* Grow buffer if needed */
-        if (total_size + received > capacity) {
-            size_t new_capacity = capacity * 2;
-            if (new_capacity > MAX_RESPONSE_SIZE) {
-                new_capacity = MAX_RESPONSE_SIZE;
+    for (;;) {
+        SDL_LockMutex(engine_lock);
+        bool quit = engine_quit;
+        GeminiRequest *incoming = submitted;
+        submitted = NULL;
+        SDL_UnlockMutex(engine_lock);
+
+        while (incoming) {
+            GeminiRequest *req = incoming;
+            incoming = req->next;
+            scheduler_submit(req);
+        }
+
+        GeminiRequest *req;
+        SchedulerVerdict verdict;
+        if (quit) {
+            /* Complete everything still waiting as cancelled */
+            GeminiRequest *waiting = scheduler_take_all();
+            while (waiting) {
+                req = waiting;
+                waiting = req->next;
+                req->next = NULL;
+                req->cancelled = 1;
+                conn_start(req, SCHEDULER_START);
             }
-            if (total_size + received > new_capacity) {
-                /* Response too large */
-                break;
+        }
+        while ((req = scheduler_next(&verdict)) != NULL) {
+            conn_start(req, verdict);
+        }
+
+        if (quit) {
+            for (GeminiConn *c = conns; c; c = c->next) {
+                if (!c->req) continue;
+                c->req->cancelled = 1;
+                conn_complete(c);
             }
-            char *new_data = realloc(data, new_capacity);
-            if (!new_data) {
-                break;
+            reap_conns();
+            break;
+        }
+
+        for (GeminiConn *c = conns; c; c = c->next) {
+            if (c->req) conn_check(c);
+        }
+        reap_conns();
+        bool event_pending = !notify_completed();
+
+        /* Size the poll set for the worst case: every connection racing */
+        int count = 1;
+        for (GeminiConn *c = conns; c; c = c->next) count++;
+        int needed = 1 + (count - 1) * RESOLVER_MAX_ADDRS;
+        if (needed > fds_capacity) {
+            struct pollfd *grown = realloc(fds, needed * sizeof(struct pollfd));
+            if (grown) {
+                fds = grown;
+                fds_capacity = needed;
             }
-            data = new_data;
-            capacity = new_capacity;
+        }
+        if (!fds) {
+            SDL_Delay(EVENT_RETRY_MS);
+            continue;
         }
 
-        memcpy(data + total_size, buffer, received);
-        total_size += received;
+        fds[0].fd = wake_pipe[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        int nfds = 1;
+        int wait = event_pending ? EVENT_RETRY_MS : ENGINE_MAX_WAIT_MS;
+        int scheduled = scheduler_timeout();
+        if (scheduled >= 0 && scheduled < wait) wait = scheduled;
+        for (GeminiConn *c = conns; c; c = c->next) {
+            c->first_fd = nfds;
+            c->nfds = nfds + RESOLVER_MAX_ADDRS <= fds_capacity ? conn_pollfds(c, fds + nfds) : 0;
+            nfds += c->nfds;
 
-        if (total_size >= MAX_RESPONSE_SIZE) {
-            break;
+            int timeout = conn_timeout(c);
+            if (timeout < wait) wait = timeout;
         }
-    }
 
-    SSL_shutdown(ssl);
-    SSL_free(ssl);
-    close(sock);
+        if (poll(fds, nfds, wait) < 0 && errno != EINTR) {
+            SDL_Delay(EVENT_RETRY_MS);
+        }
 
-    /* Parse response header */
-    if (total_size < 3) {
-        free(data);
-        resp->status = GM_STATUS_ERROR_HEADER;
-        strncpy(resp->error_msg, "Response too short", sizeof(resp->error_msg) - 1);
-        return resp;
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        for (GeminiConn *c = conns; c; c = c->next) {
+            if (c->req && c->nfds) conn_step(c, fds + c->first_fd, c->nfds);
+        }
+        reap_conns();
     }
 
-    /* Find end of header line (CRLF) */
-    char *header_end = NULL;
-    for (size_t i = 0; i < total_size - 1; i++) {
-        if (data[i] == '\r' && data[i + 1] == '\n') {
-            header_end = data + i;
-            break;
+    free(fds);
+    return 0;
+}
+
+/* Queue req for the engine. Returns false if the engine isn't running. */
+static bool engine_submit(GeminiRequest *req) {
+    if (!engine_lock) return false;
+
+    SDL_LockMutex(engine_lock);
+    bool running = engine && !engine_quit;
+    if (running) {
+        GeminiRequest **pp = &submitted;
+        while (*pp) pp = &(*pp)->next;
+        *pp = req;
+
+        engine_stats.started++;
+        engine_stats.active++;
+        if (engine_stats.active > engine_stats.peak_active) {
+            engine_stats.peak_active = engine_stats.active;
         }
     }
+    SDL_UnlockMutex(engine_lock);
 
-    if (!header_end) {
-        free(data);
-        resp->status = GM_STATUS_ERROR_HEADER;
-        strncpy(resp->error_msg, "Malformed response header", sizeof(resp->error_msg) - 1);
-        return resp;
+    if (running) engine_wake();
+    return running;
+}
+
+static GeminiRequest *request_new(const Url *url, const GeminiRequestOptions *opts) {
+    GeminiRequest *req = calloc(1, sizeof(GeminiRequest));
+    if (!req) return NULL;
+
+    memcpy(&req->url, url, sizeof(Url));
+    req->deadline = SDL_GetTicks() + GEMINI_DEFAULT_TIMEOUT_MS;
+    if (opts) {
+        req->flags = opts->flags;
+        req->priority = opts->priority;
+        req->userdata = opts->userdata;
+        req->token = opts->cancel;
+        req->handler = opts->handler;
+        req->handler_data = opts->handler_data;
+        if (opts->deadline) req->deadline = opts->deadline;
+        req->idle_timeout = opts->idle_timeout;
     }
+    return req;
+}
 
-    /* Parse status code (first two digits) */
-    if (header_end - data < 2 || !isdigit((unsigned char)data[0]) || !isdigit((unsigned char)data[1])) {
-        free(data);
-        resp->status = GM_STATUS_ERROR_HEADER;
-        strncpy(resp->error_msg, "Invalid status code", sizeof(resp->error_msg) - 1);
+/* Run a request on the engine and wait for it */
+static GeminiResponse *fetch_blocking(const Url *url, const GeminiRequestOptions *opts,
+                                      const GeminiStreamHandler *handler, void *userdata) {
+    if (!url) return NULL;
+
+    GeminiRequest *req = request_new(url, opts);
+    if (!req) return NULL;
+    req->sync = true;
+    if (handler) {
+        req->handler = handler;
+        req->handler_data = userdata;
+    }
+
+    if (!engine_submit(req)) {
+        free(req);
+        GeminiResponse *resp = calloc(1, sizeof(GeminiResponse));
+        if (resp) {
+            resp->status = GM_STATUS_ERROR_TLS;
+            strncpy(resp->error_msg, "SSL not initialized", sizeof(resp->error_msg) - 1);
+        }
         return resp;
     }
 
-    resp->status = (data[0] - '0') * 10 + (data[1] - '0');
+    SDL_LockMutex(engine_lock);
+    while (!req->finished) {
+        SDL_CondWait(sync_done, engine_lock);
+    }
+    SDL_UnlockMutex(engine_lock);
 
-    /* Parse meta (everything after status and space until CRLF) */
-    const char *meta_start = data + 2;
-    if (*meta_start == ' ') meta_start++;
-    size_t meta_len = header_end - meta_start;
-    if (meta_len >= sizeof(resp->meta)) meta_len = sizeof(resp->meta) - 1;
-    strncpy(resp->meta, meta_start, meta_len);
-    resp->meta[meta_len] = '\0';
+    GeminiResponse *resp = req->response;
+    req->response = NULL;
+    gemini_request_free(req);
+    return resp;
+}
 
-    /* Body starts after CRLF */
-    char *body_start = header_end + 2;
-    size_t body_len = total_size - (body_start - data);
+GeminiResponse *gemini_fetch(const Url *url) {
+    return fetch_blocking(url, NULL, NULL, NULL);
+}
 
-    if (body_len > 0) {
-        resp->body = malloc(body_len + 1);
-        if (resp->body) {
-            memcpy(resp->body, body_start, body_len);
-            resp->body[body_len] = '\0';
-            resp->body_len = body_len;
-        }
+GeminiResponse *gemini_fetch_ex(const Url *url, const GeminiRequestOptions *opts) {
+    return fetch_blocking(url, opts, NULL, NULL);
+}
+
+GeminiResponse *gemini_fetch_stream(const Url *url, const GeminiStreamHandler *handler,
+                                    void *userdata) {
+    static const GeminiStreamHandler ignore_body = { NULL, NULL };
+    return fetch_blocking(url, NULL, handler ? handler : &ignore_body, userdata);
+}
+
+GeminiRequest *gemini_fetch_async(const Url *url, unsigned flags, void *userdata) {
+    GeminiRequestOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = flags;
+    opts.userdata = userdata;
+    return gemini_fetch_async_ex(url, &opts);
+}
+
+GeminiRequest *gemini_fetch_async_ex(const Url *url, const GeminiRequestOptions *opts) {
+    if (!url) return NULL;
+
+    GeminiRequest *req = request_new(url, opts);
+    if (!req) return NULL;
+
+    if (!engine_submit(req)) {
+        free(req);
+        return NULL;
     }
+    return req;
+}
 
-    free(data);
-    return resp;
+GeminiRequest *gemini_take_completed(void) {
+    if (!engine_lock) return NULL;
+
+    SDL_LockMutex(engine_lock);
+    GeminiRequest *req = completed;
+    if (req) {
+        completed = req->next;
+        if (!completed) completed_tail = NULL;
+        req->next = NULL;
+    }
+    else {
+        /* Drained - the next completion posts a new event */
+        completed_notified = false;
+    }
+    SDL_UnlockMutex(engine_lock);
+    return req;
+}
+
+void gemini_set_fast_open(bool enable) {
+    fast_open = enable;
+}
+
+bool gemini_fast_open(void) {
+    return fast_open;
+}
+
+void gemini_fetch_promote(GeminiRequest *req, GeminiPriority priority) {
+    if (!req || req->priority <= (int)priority) return;
+
+    req->priority = priority;
+    engine_wake();
+}
+
+void gemini_fetch_cancel(GeminiRequest *req) {
+    if (!req) return;
+
+    req->cancelled = 1;
+    engine_wake();
+}
+
+void gemini_cancel_token_fire(GeminiCancelToken *token) {
+    if (!token) return;
+
+    token->fired = 1;
+    engine_wake();
+}
+
+void gemini_request_free(GeminiRequest *req) {
+    if (!req) return;
+
+    gemini_response_free(req->response);
+    free(req);
 }
 
 void gemini_response_free(GeminiResponse *resp) {
     if (resp) {
-        free(resp->body);
+        free(resp->body_base ? resp->body_base : resp->body);
         free(resp);
     }
 }
 
+void gemini_recv_stats(GeminiRecvStats *out) {
+    if (out) *out = recv_stats;
+}
+
+void gemini_engine_stats(GeminiEngineStats *out) {
+    if (!out) return;
+    if (!engine_lock) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    SDL_LockMutex(engine_lock);
+    *out = engine_stats;
+    SDL_UnlockMutex(engine_lock);
+}
+
+long gemini_phase_ms(const GeminiTrace *trace, GeminiPhase phase) {
+    if (!trace) return -1;
+
+    Uint32 from, to;
+    switch (phase) {
+        case GEMINI_PHASE_DNS:       from = trace->start;      to = trace->resolved;   break;
+        case GEMINI_PHASE_CONNECT:   from = trace->resolved;   to = trace->connected;  break;
+        case GEMINI_PHASE_HANDSHAKE: from = trace->connected;  to = trace->handshaken; break;
+        case GEMINI_PHASE_WAIT:      from = trace->sent;       to = trace->first_byte; break;
+        case GEMINI_PHASE_TRANSFER:  from = trace->first_byte; to = trace->done;       break;
+        case GEMINI_PHASE_TOTAL:     from = trace->start;      to = trace->done;       break;
+        default:                     return -1;
+    }
+    if (!from || !to) return -1;
+    return (long)(to - from);
+}
+
+const char *gemini_phase_name(GeminiPhase phase) {
+    switch (phase) {
+        case GEMINI_PHASE_DNS:       return "DNS";
+        case GEMINI_PHASE_CONNECT:   return "Connect";
+        case GEMINI_PHASE_HANDSHAKE: return "TLS handshake";
+        case GEMINI_PHASE_WAIT:      return "First byte";
+        case GEMINI_PHASE_TRANSFER:  return "Transfer";
+        case GEMINI_PHASE_TOTAL:     return "Total";
+        default:                     return "Unknown";
+    }
+}
+
+const char *gemini_priority_name(GeminiPriority priority) {
+    switch (priority) {
+        case GEMINI_PRIORITY_INTERACTIVE: return "Navigation";
+        case GEMINI_PRIORITY_REVALIDATE:  return "Revalidation";
+        case GEMINI_PRIORITY_PREFETCH:    return "Prefetch";
+        case GEMINI_PRIORITY_BULK:        return "Bulk";
+        default:                          return "Unknown";
+    }
+}
+
 int gemini_status_category(GeminiStatus status) {
     if (status < 0) return -1;
     if (status < 10) return status;
@@ -359,6 +1360,8 @@ const char *gemini_status_string(GeminiStatus status) {
         case GM_STATUS_ERROR_HEADER:    return "Invalid response header";
         case GM_STATUS_ERROR_TIMEOUT:   return "Request timed out";
         case GM_STATUS_ERROR_MEMORY:    return "Out of memory";
+        case GM_STATUS_ERROR_CANCELLED: return "Request cancelled";
+        case GM_STATUS_ERROR_UNREACHABLE: return "Host recently unreachable";
         default:                        return "Unknown status";
     }
 }
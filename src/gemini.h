@@ -4,6 +4,8 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <SDL.h>
+#include <SDL_thread.h>
 #include "url.h"
 
 /* Gemini status codes */
@@ -33,30 +35,226 @@ typedef enum {
     GM_STATUS_ERROR_RECV         = -4,
     GM_STATUS_ERROR_HEADER       = -5,
     GM_STATUS_ERROR_TIMEOUT      = -6,
-    GM_STATUS_ERROR_MEMORY       = -7
+    GM_STATUS_ERROR_MEMORY       = -7,
+    GM_STATUS_ERROR_CANCELLED    = -8,
+    GM_STATUS_ERROR_UNREACHABLE  = -9      /* Failed recently, not tried again */
 } GeminiStatus;
 
+/* How a response was fetched. Times are SDL_GetTicks() values taken as
+ * each phase ended, 0 for phases that weren't reached. */
+typedef struct {
+    Uint32 start;           /* Lookup started, 0 if the engine answered without
+                             * the network (expired, backed off, unreachable) */
+    Uint32 resolved;        /* Addresses known */
+    Uint32 connected;       /* TCP connection established */
+    Uint32 handshaken;      /* TLS handshake complete */
+    Uint32 sent;            /* Request line written */
+    Uint32 first_byte;      /* First response byte read */
+    Uint32 done;            /* Transfer finished */
+    size_t received;        /* Bytes read, header included */
+    char tls_version[16];   /* e.g. "TLSv1.2", empty without a handshake */
+    char tls_cipher[64];
+    bool tls_resumed;       /* Handshake resumed a cached session */
+} GeminiTrace;
+
+/* Spans between GeminiTrace times, for gemini_phase_ms() */
+typedef enum {
+    GEMINI_PHASE_DNS,       /* start - resolved */
+    GEMINI_PHASE_CONNECT,   /* resolved - connected */
+    GEMINI_PHASE_HANDSHAKE, /* connected - handshaken */
+    GEMINI_PHASE_WAIT,      /* sent - first_byte: time to first byte */
+    GEMINI_PHASE_TRANSFER,  /* first_byte - done */
+    GEMINI_PHASE_TOTAL,     /* start - done */
+    GEMINI_PHASE_COUNT
+} GeminiPhase;
+
 /* Response from a Gemini request */
 typedef struct {
     GeminiStatus status;
     char meta[1024];        /* MIME type or redirect URL or prompt */
     char *body;             /* Response body (caller must free) */
     size_t body_len;
+    bool truncated;         /* Body cut short at the size limit */
     char error_msg[256];    /* Human-readable error message */
+    char *body_base;        /* Allocation body points into, if not body itself */
+    GeminiTrace trace;      /* Kept in copies, zero for responses read from disk */
 } GeminiResponse;
 
+/* Receive path counters, for buffered fetches */
+typedef struct {
+    unsigned long fetches;
+    unsigned long long received;    /* Bytes read, header included */
+    unsigned long long moved;       /* Bytes relocated by growing the buffer */
+    unsigned long grows;            /* Buffer reallocations */
+    size_t peak_buffer;             /* Largest receive buffer of one fetch */
+} GeminiRecvStats;
+
+/* Fetch engine counters */
+typedef struct {
+    unsigned long started;
+    unsigned long completed;
+    int active;                     /* Transfers in progress */
+    int peak_active;
+    unsigned long pauses;           /* Transfers paused for a navigation */
+} GeminiEngineStats;
+
+/* SDL_USEREVENT code posted when finished asynchronous requests are
+ * waiting in the completion queue. Take them with gemini_take_completed(). */
+#define GEMINI_EVENT_FETCH_DONE 1
+
+/* gemini_fetch_async() flags */
+#define GEMINI_FETCH_TEXT_ONLY  0x01    /* Don't download non-text bodies */
+#define GEMINI_FETCH_SMALL      0x02    /* Stop after GEMINI_SMALL_BODY_MAX bytes */
+
+/* Request priority classes, most urgent first. Waiting requests start in
+ * class order, and prefetch and bulk transfers neither start nor read
+ * while a navigation is in flight. */
+typedef enum {
+    GEMINI_PRIORITY_INTERACTIVE,    /* The page the user is opening */
+    GEMINI_PRIORITY_REVALIDATE,     /* Refreshing a page shown from the cache */
+    GEMINI_PRIORITY_PREFETCH,       /* Pages the user may open next */
+    GEMINI_PRIORITY_BULK,           /* Downloads and other long transfers */
+    GEMINI_PRIORITY_COUNT
+} GeminiPriority;
+
+#define GEMINI_SMALL_BODY_MAX   (128 * 1024)
+
+#define GEMINI_DEFAULT_TIMEOUT_MS (60 * 1000)   /* Whole request, unless a deadline is given */
+
+/* Cancels every request it was given to. Keep it alive until they have
+ * all completed. */
+typedef struct {
+    volatile int fired;
+} GeminiCancelToken;
+
+struct GeminiStreamHandler;
+
+/* Per-request options for gemini_fetch_ex() and gemini_fetch_async_ex() */
+typedef struct {
+    unsigned flags;             /* GEMINI_FETCH_* */
+    GeminiPriority priority;    /* Default GEMINI_PRIORITY_INTERACTIVE */
+    Uint32 deadline;            /* SDL_GetTicks() by which the whole request must
+                                 * finish, 0 = GEMINI_DEFAULT_TIMEOUT_MS from now */
+    Uint32 idle_timeout;        /* Milliseconds the body may go without data, 0 =
+                                 * none. When set, deadline stops at the header. */
+    GeminiCancelToken *cancel;  /* Optional, checked in every phase */
+    void *userdata;             /* Becomes GeminiRequest.userdata */
+
+    /* Optional. Streams the body to handler in fixed-size chunks instead
+     * of collecting it, so memory use doesn't grow with the body. The
+     * callbacks run on the engine thread. */
+    const struct GeminiStreamHandler *handler;
+    void *handler_data;
+} GeminiRequestOptions;
+
+/* Asynchronous request, driven by the fetch engine thread */
+typedef struct GeminiRequest {
+    Url url;
+    GeminiResponse *response;   /* Valid once taken from the completion queue */
+    void *userdata;             /* Caller context, not touched by gemini.c */
+    unsigned flags;             /* GEMINI_FETCH_* */
+
+    /* Internal */
+    volatile int cancelled;
+    volatile int finished;
+    Uint32 deadline;
+    Uint32 idle_timeout;
+    GeminiCancelToken *token;
+    bool sync;                  /* A blocking caller waits for it */
+    const struct GeminiStreamHandler *handler;
+    void *handler_data;
+    volatile int priority;      /* GeminiPriority, see gemini_fetch_promote() */
+    int attempts;               /* Retries after 40, 41 or 44 */
+    Uint32 queued_at;           /* SDL_GetTicks() it reached the scheduler */
+    Uint32 retry_at;            /* SDL_GetTicks() of the next attempt, 0 = now */
+    bool waited;                /* Counted as delayed by the scheduler */
+    bool running;               /* Counted against its host by the scheduler */
+    GeminiPriority running_as;  /* Class it was counted in while running */
+    struct GeminiRequest *next;
+} GeminiRequest;
+
 /* Initialize the Gemini subsystem (OpenSSL) */
 bool gemini_init(void);
 
 /* Cleanup the Gemini subsystem */
 void gemini_cleanup(void);
 
-/* Fetch a Gemini URL. Caller must call gemini_response_free() on result. */
+/* Write persistent network state (TLS sessions, host statistics) to disk */
+void gemini_persist(void);
+
+/* Fetch a Gemini URL, blocking until it completes. Caller must call
+ * gemini_response_free() on result. */
 GeminiResponse *gemini_fetch(const Url *url);
 
+/* gemini_fetch() with options (opts may be NULL). A request that misses
+ * its deadline, in whichever phase, ends with GM_STATUS_ERROR_TIMEOUT. */
+GeminiResponse *gemini_fetch_ex(const Url *url, const GeminiRequestOptions *opts);
+
+/* Streaming consumer. Returning false from a callback ends the transfer.
+ * Callbacks run on the fetch engine thread while the caller waits. */
+typedef struct GeminiStreamHandler {
+    /* Called as soon as the "<status> <meta>" line is parsed. A 40, 41 or 44
+     * header may be followed by another attempt and header later. */
+    bool (*on_header)(const GeminiResponse *resp, void *userdata);
+    /* Called for each chunk of body data as it is read */
+    bool (*on_body)(const char *data, size_t len, void *userdata);
+} GeminiStreamHandler;
+
+/* Fetch a URL, handing the header and body chunks to handler as they arrive.
+ * The returned response has status, meta and error_msg but no body. */
+GeminiResponse *gemini_fetch_stream(const Url *url, const GeminiStreamHandler *handler,
+                                    void *userdata);
+
+/* Start fetching a URL on the engine thread. The request is put on the
+ * completion queue when it finishes. Returns NULL on failure. */
+GeminiRequest *gemini_fetch_async(const Url *url, unsigned flags, void *userdata);
+
+/* gemini_fetch_async() with options (opts may be NULL) */
+GeminiRequest *gemini_fetch_async_ex(const Url *url, const GeminiRequestOptions *opts);
+
+/* Next finished asynchronous request, oldest first, or NULL once the
+ * queue is empty. Call until NULL after each GEMINI_EVENT_FETCH_DONE. */
+GeminiRequest *gemini_take_completed(void);
+
+/* Use TCP Fast Open for new connections where the kernel supports it.
+ * Off by default. Hosts where it broke more connections than it sped
+ * up don't get it. */
+void gemini_set_fast_open(bool enable);
+bool gemini_fast_open(void);
+
+/* Raise a request to priority, e.g. when the user opens a page that
+ * was being prefetched. Never lowers it. */
+void gemini_fetch_promote(GeminiRequest *req, GeminiPriority priority);
+
+/* Abort an in-flight request. It still completes, with status
+ * GM_STATUS_ERROR_CANCELLED. */
+void gemini_fetch_cancel(GeminiRequest *req);
+
+/* Cancel every request that was given token */
+void gemini_cancel_token_fire(GeminiCancelToken *token);
+
+/* Free a request and its response. Only call after it has been taken
+ * from the completion queue. */
+void gemini_request_free(GeminiRequest *req);
+
 /* Free a response */
 void gemini_response_free(GeminiResponse *resp);
 
+/* Get a snapshot of the receive path counters */
+void gemini_recv_stats(GeminiRecvStats *stats);
+
+/* Get a snapshot of the fetch engine counters */
+void gemini_engine_stats(GeminiEngineStats *stats);
+
+/* Milliseconds a phase took, or -1 if it didn't complete */
+long gemini_phase_ms(const GeminiTrace *trace, GeminiPhase phase);
+
+/* Short name of a phase, e.g. "DNS" */
+const char *gemini_phase_name(GeminiPhase phase);
+
+/* Name of a priority class */
+const char *gemini_priority_name(GeminiPriority priority);
+
 /* Get status category (1=input, 2=success, 3=redirect, etc) */
 int gemini_status_category(GeminiStatus status);
 
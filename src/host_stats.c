@@ -0,0 +1,307 @@
+/* Gemini Browser - Per-host latency and status histograms */
+#include "host_stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <SDL.h>
+#include <SDL_mutex.h>
+
+/* On-disk format: magic, metric, bucket, result and Fast Open outcome
+ * counts, host count, then per host: name length (u16), name, last_used
+ * (u32), histograms, results and Fast Open outcomes (u32 each). A file
+ * with other dimensions is ignored. */
+#define HOST_FILE_MAGIC     0x47485332  /* "GHS2" */
+
+static HostStats entries[HOST_STATS_MAX];
+static int num_entries = 0;
+static bool dirty = false;
+static char stats_path[256];
+static SDL_mutex *lock = NULL;
+
+static int find_entry(const char *host) {
+    for (int i = 0; i < num_entries; i++) {
+        if (strcmp(entries[i].host, host) == 0) return i;
+    }
+    return -1;
+}
+
+/* Entry for host, replacing the one used longest ago if full */
+static HostStats *get_entry(const char *host) {
+    int index = find_entry(host);
+    if (index >= 0) return &entries[index];
+
+    if (num_entries < HOST_STATS_MAX) {
+        index = num_entries++;
+    }
+    else {
+        index = 0;
+        for (int i = 1; i < num_entries; i++) {
+            if (entries[i].last_used < entries[index].last_used) index = i;
+        }
+    }
+
+    HostStats *e = &entries[index];
+    memset(e, 0, sizeof(*e));
+    strncpy(e->host, host, sizeof(e->host) - 1);
+    return e;
+}
+
+static int bucket_of(long ms) {
+    int bucket = 0;
+    while (ms > 0 && bucket < HOST_STATS_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void add_time(HostStats *e, HostMetric metric, long ms) {
+    if (ms >= 0) e->histograms[metric][bucket_of(ms)]++;
+}
+
+static HostResult result_of(GeminiStatus status) {
+    switch (status) {
+        case GM_STATUS_ERROR_CONNECT:   return HOST_RESULT_CONNECT_ERROR;
+        case GM_STATUS_ERROR_TLS:       return HOST_RESULT_TLS_ERROR;
+        case GM_STATUS_ERROR_TIMEOUT:   return HOST_RESULT_TIMEOUT;
+        default:                        break;
+    }
+
+    int category = gemini_status_category(status);
+    if (category >= 1 && category <= 6) return (HostResult)(HOST_RESULT_INPUT + category - 1);
+    return HOST_RESULT_OTHER_ERROR;
+}
+
+static void load_file(void) {
+    FILE *f = fopen(stats_path, "rb");
+    if (!f) return;
+
+    uint32_t header[6];
+    if (fread(header, sizeof(header), 1, f) != 1 || header[0] != HOST_FILE_MAGIC ||
+        header[1] != HOST_METRIC_COUNT || header[2] != HOST_STATS_BUCKETS ||
+        header[3] != HOST_RESULT_COUNT || header[4] != HOST_FAST_OPEN_COUNT) {
+        fclose(f);
+        return;
+    }
+
+    for (uint32_t i = 0; i < header[5] && num_entries < HOST_STATS_MAX; i++) {
+        HostStats *e = &entries[num_entries];
+        uint16_t host_len;
+
+        memset(e, 0, sizeof(*e));
+        if (fread(&host_len, sizeof(host_len), 1, f) != 1 || host_len == 0 ||
+            host_len >= sizeof(e->host)) break;
+        if (fread(e->host, 1, host_len, f) != host_len) break;
+        if (fread(&e->last_used, sizeof(e->last_used), 1, f) != 1 ||
+            fread(e->histograms, sizeof(e->histograms), 1, f) != 1 ||
+            fread(e->results, sizeof(e->results), 1, f) != 1 ||
+            fread(e->fast_open, sizeof(e->fast_open), 1, f) != 1) break;
+        num_entries++;
+    }
+
+    fclose(f);
+}
+
+bool host_stats_init(const char *path) {
+    if (!lock) {
+        lock = SDL_CreateMutex();
+        if (!lock) return false;
+    }
+
+    strncpy(stats_path, path, sizeof(stats_path) - 1);
+    num_entries = 0;
+    load_file();
+    dirty = false;
+    return true;
+}
+
+void host_stats_cleanup(void) {
+    if (!lock) return;
+
+    host_stats_save();
+
+    SDL_DestroyMutex(lock);
+    lock = NULL;
+    num_entries = 0;
+}
+
+bool host_stats_save(void) {
+    if (!lock) return false;
+
+    SDL_LockMutex(lock);
+    if (!dirty) {
+        SDL_UnlockMutex(lock);
+        return true;
+    }
+
+    /* Write to a temporary file and rename, as the session cache does */
+    char tmp_path[sizeof(stats_path) + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", stats_path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        SDL_UnlockMutex(lock);
+        return false;
+    }
+
+    uint32_t header[6] = { HOST_FILE_MAGIC, HOST_METRIC_COUNT, HOST_STATS_BUCKETS,
+                           HOST_RESULT_COUNT, HOST_FAST_OPEN_COUNT, (uint32_t)num_entries };
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+
+    for (int i = 0; ok && i < num_entries; i++) {
+        const HostStats *e = &entries[i];
+        uint16_t host_len = (uint16_t)strlen(e->host);
+        ok = fwrite(&host_len, sizeof(host_len), 1, f) == 1 &&
+             fwrite(e->host, 1, host_len, f) == host_len &&
+             fwrite(&e->last_used, sizeof(e->last_used), 1, f) == 1 &&
+             fwrite(e->histograms, sizeof(e->histograms), 1, f) == 1 &&
+             fwrite(e->results, sizeof(e->results), 1, f) == 1 &&
+             fwrite(e->fast_open, sizeof(e->fast_open), 1, f) == 1;
+    }
+
+    if (fclose(f) != 0) ok = false;
+    if (ok && rename(tmp_path, stats_path) == 0) {
+        dirty = false;
+    }
+    else {
+        remove(tmp_path);
+        ok = false;
+    }
+
+    SDL_UnlockMutex(lock);
+    return ok;
+}
+
+void host_stats_record(const char *host, const GeminiResponse *resp) {
+    if (!lock || !host || !host[0] || !resp) return;
+    /* None of these reached the network, or say anything about the host */
+    if (!resp->trace.start ||
+        resp->status == GM_STATUS_ERROR_CANCELLED ||
+        resp->status == GM_STATUS_ERROR_UNREACHABLE) return;
+
+    const GeminiTrace *trace = &resp->trace;
+    SDL_LockMutex(lock);
+    HostStats *e = get_entry(host);
+    e->last_used = (uint32_t)time(NULL);
+    add_time(e, HOST_METRIC_CONNECT, gemini_phase_ms(trace, GEMINI_PHASE_CONNECT));
+    add_time(e, trace->tls_resumed ? HOST_METRIC_RESUMED : HOST_METRIC_HANDSHAKE,
+             gemini_phase_ms(trace, GEMINI_PHASE_HANDSHAKE));
+    add_time(e, HOST_METRIC_TTFB, gemini_phase_ms(trace, GEMINI_PHASE_WAIT));
+    add_time(e, HOST_METRIC_TOTAL, gemini_phase_ms(trace, GEMINI_PHASE_TOTAL));
+    e->results[result_of(resp->status)]++;
+    dirty = true;
+    SDL_UnlockMutex(lock);
+}
+
+void host_stats_record_fast_open(const char *host, HostFastOpen outcome) {
+    if (!lock || !host || !host[0] || (unsigned)outcome >= HOST_FAST_OPEN_COUNT) return;
+
+    SDL_LockMutex(lock);
+    HostStats *e = get_entry(host);
+    e->last_used = (uint32_t)time(NULL);
+    e->fast_open[outcome]++;
+    dirty = true;
+    SDL_UnlockMutex(lock);
+}
+
+bool host_stats_fast_open_allowed(const char *host) {
+    if (!lock || !host) return true;
+
+    SDL_LockMutex(lock);
+    int index = find_entry(host);
+    bool allowed = index < 0 ||
+                   entries[index].fast_open[HOST_FAST_OPEN_FAILED] <=
+                   entries[index].fast_open[HOST_FAST_OPEN_ACCEPTED];
+    SDL_UnlockMutex(lock);
+    return allowed;
+}
+
+int host_stats_snapshot(HostStats *out, int max) {
+    if (!lock || !out || max <= 0) return 0;
+
+    SDL_LockMutex(lock);
+    int n = num_entries < max ? num_entries : max;
+
+    /* Selection of the busiest hosts, so a small max still gets the top */
+    bool taken[HOST_STATS_MAX] = { false };
+    for (int i = 0; i < n; i++) {
+        int best = -1;
+        uint32_t best_total = 0;
+        for (int j = 0; j < num_entries; j++) {
+            uint32_t total = host_stats_total(entries[j].results, HOST_RESULT_COUNT);
+            if (!taken[j] && (best < 0 || total > best_total)) {
+                best = j;
+                best_total = total;
+            }
+        }
+        taken[best] = true;
+        out[i] = entries[best];
+    }
+    SDL_UnlockMutex(lock);
+    return n;
+}
+
+uint32_t host_stats_total(const uint32_t *counts, int n) {
+    uint32_t total = 0;
+    for (int i = 0; i < n; i++) {
+        total += counts[i];
+    }
+    return total;
+}
+
+int host_stats_percentile(const uint32_t *histogram, int percent) {
+    uint32_t total = host_stats_total(histogram, HOST_STATS_BUCKETS);
+    if (total == 0) return -1;
+
+    /* Smallest bucket with at least percent of the samples at or below it */
+    unsigned long long need = ((unsigned long long)total * percent + 99) / 100;
+    if (need == 0) need = 1;
+    unsigned long long seen = 0;
+    for (int b = 0; b < HOST_STATS_BUCKETS; b++) {
+        seen += histogram[b];
+        if (seen >= need) return b;
+    }
+    return HOST_STATS_BUCKETS - 1;
+}
+
+long host_stats_bucket_limit(int bucket) {
+    if (bucket < 0 || bucket >= HOST_STATS_BUCKETS - 1) return -1;
+    return 1L << bucket;
+}
+
+const char *host_stats_metric_name(HostMetric metric) {
+    switch (metric) {
+        case HOST_METRIC_CONNECT:   return "Connect";
+        case HOST_METRIC_HANDSHAKE: return "Full handshake";
+        case HOST_METRIC_RESUMED:   return "Resumed handshake";
+        case HOST_METRIC_TTFB:      return "First byte";
+        case HOST_METRIC_TOTAL:     return "Total";
+        default:                    return "Unknown";
+    }
+}
+
+const char *host_stats_fast_open_name(HostFastOpen outcome) {
+    switch (outcome) {
+        case HOST_FAST_OPEN_COOKIE:     return "cookie requested";
+        case HOST_FAST_OPEN_ACCEPTED:   return "data in SYN accepted";
+        case HOST_FAST_OPEN_IGNORED:    return "data in SYN ignored";
+        case HOST_FAST_OPEN_FAILED:     return "failed";
+        default:                        return "unknown";
+    }
+}
+
+const char *host_stats_result_name(HostResult result) {
+    switch (result) {
+        case HOST_RESULT_INPUT:         return "1x input";
+        case HOST_RESULT_SUCCESS:       return "2x success";
+        case HOST_RESULT_REDIRECT:      return "3x redirect";
+        case HOST_RESULT_TEMP_FAILURE:  return "4x temporary failure";
+        case HOST_RESULT_PERM_FAILURE:  return "5x permanent failure";
+        case HOST_RESULT_CERT:          return "6x certificate";
+        case HOST_RESULT_CONNECT_ERROR: return "connect failed";
+        case HOST_RESULT_TLS_ERROR:     return "TLS failed";
+        case HOST_RESULT_TIMEOUT:       return "timed out";
+        case HOST_RESULT_OTHER_ERROR:   return "other error";
+        default:                        return "unknown";
+    }
+}
@@ -0,0 +1,95 @@
+/* Gemini Browser - Per-host latency and status histograms */
+#ifndef PALMINI_HOST_STATS_H
+#define PALMINI_HOST_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "gemini.h"
+
+#define HOST_STATS_MAX      32
+#define HOST_STATS_BUCKETS  18      /* Up to 2^16 ms, then one open-ended bucket */
+#define HOST_STATS_FILE     "/media/internal/gemini-hosts.dat"
+
+/* Timings kept per host */
+typedef enum {
+    HOST_METRIC_CONNECT,        /* TCP connect */
+    HOST_METRIC_HANDSHAKE,      /* Full TLS handshake */
+    HOST_METRIC_RESUMED,        /* TLS handshake resuming a session */
+    HOST_METRIC_TTFB,           /* Request written to first response byte */
+    HOST_METRIC_TOTAL,          /* Whole request */
+    HOST_METRIC_COUNT
+} HostMetric;
+
+/* How requests ended: status categories, then failures without one */
+typedef enum {
+    HOST_RESULT_INPUT,          /* 1x */
+    HOST_RESULT_SUCCESS,        /* 2x */
+    HOST_RESULT_REDIRECT,       /* 3x */
+    HOST_RESULT_TEMP_FAILURE,   /* 4x */
+    HOST_RESULT_PERM_FAILURE,   /* 5x */
+    HOST_RESULT_CERT,           /* 6x */
+    HOST_RESULT_CONNECT_ERROR,  /* DNS or TCP */
+    HOST_RESULT_TLS_ERROR,
+    HOST_RESULT_TIMEOUT,
+    HOST_RESULT_OTHER_ERROR,
+    HOST_RESULT_COUNT
+} HostResult;
+
+/* How TCP Fast Open went, for connections that asked for it */
+typedef enum {
+    HOST_FAST_OPEN_COOKIE,      /* No cookie yet - ordinary connect asking for one */
+    HOST_FAST_OPEN_ACCEPTED,    /* The ClientHello in the SYN was accepted */
+    HOST_FAST_OPEN_IGNORED,     /* Sent in the SYN but the server didn't take it */
+    HOST_FAST_OPEN_FAILED,      /* Connection broke before the handshake finished */
+    HOST_FAST_OPEN_COUNT
+} HostFastOpen;
+
+/* Bucket 0 counts times under 1 ms, bucket b (b > 0) times from
+ * 2^(b-1) up to 2^b ms, and the last bucket everything longer */
+typedef struct {
+    char host[256];
+    uint32_t last_used;         /* time() of the last request */
+    uint32_t histograms[HOST_METRIC_COUNT][HOST_STATS_BUCKETS];
+    uint32_t results[HOST_RESULT_COUNT];
+    uint32_t fast_open[HOST_FAST_OPEN_COUNT];
+} HostStats;
+
+/* Initialize and load the histograms saved at path */
+bool host_stats_init(const char *path);
+
+/* Save and free everything */
+void host_stats_cleanup(void);
+
+/* Write the histograms to disk. Safe to call at any time. */
+bool host_stats_save(void);
+
+/* Add a finished request to host's histograms. Called by the fetch
+ * engine; cancelled requests and ones that never reached the network
+ * (trace.start of 0) aren't recorded. */
+void host_stats_record(const char *host, const GeminiResponse *resp);
+
+/* Add the outcome of a TCP Fast Open connection to host */
+void host_stats_record_fast_open(const char *host, HostFastOpen outcome);
+
+/* Whether to use TCP Fast Open for host: not once it has broken more
+ * connections there than it sped up */
+bool host_stats_fast_open_allowed(const char *host);
+
+/* Copy up to max hosts into out, most requests first. Returns how many. */
+int host_stats_snapshot(HostStats *out, int max);
+
+/* Total of a histogram or result row */
+uint32_t host_stats_total(const uint32_t *counts, int n);
+
+/* Bucket holding the given percentile of a histogram, or -1 if it's empty */
+int host_stats_percentile(const uint32_t *histogram, int percent);
+
+/* Upper limit of a bucket in ms, or -1 for the open-ended last one */
+long host_stats_bucket_limit(int bucket);
+
+/* Short names, e.g. "Connect", "2x success" */
+const char *host_stats_metric_name(HostMetric metric);
+const char *host_stats_result_name(HostResult result);
+const char *host_stats_fast_open_name(HostFastOpen outcome);
+
+#endif /* PALMINI_HOST_STATS_H */
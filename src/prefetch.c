@@ -0,0 +1,278 @@
+/* Gemini Browser - Speculative prefetch of visible links */
+#include "prefetch.h"
+#include "unreachable.h"
+#include <string.h>
+#include <SDL.h>
+
+typedef enum {
+    SLOT_EMPTY,
+    SLOT_LOADING,
+    SLOT_READY,
+    SLOT_FAILED         /* Remembered so it isn't retried until it expires */
+} SlotState;
+
+typedef struct {
+    SlotState state;
+    char url[MAX_URL_LENGTH];
+    GeminiRequest *req;         /* While loading */
+    GeminiResponse *resp;       /* Once ready */
+    Uint32 stored_at;
+    bool touch;                 /* Started by prefetch_touch() */
+} PrefetchSlot;
+
+static PrefetchSlot slots[PREFETCH_MAX_ENTRIES];
+static size_t stored_bytes = 0;
+static PrefetchStats stats;
+
+static void slot_clear(PrefetchSlot *slot) {
+    if (slot->resp) {
+        stored_bytes -= slot->resp->body_len;
+        gemini_response_free(slot->resp);
+    }
+    memset(slot, 0, sizeof(*slot));
+}
+
+/* Drop a finished slot. Responses nobody opened count as wasted. */
+static void slot_drop(PrefetchSlot *slot) {
+    if (slot->state == SLOT_READY) stats.wasted++;
+    slot_clear(slot);
+}
+
+static void expire_slots(void) {
+    Uint32 now = SDL_GetTicks();
+    for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+        PrefetchSlot *slot = &slots[i];
+        if ((slot->state == SLOT_READY || slot->state == SLOT_FAILED) &&
+            now - slot->stored_at >= PREFETCH_TTL_MS) {
+            slot_drop(slot);
+        }
+    }
+}
+
+static PrefetchSlot *find_slot(const char *url) {
+    for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+        if (slots[i].state != SLOT_EMPTY && strcmp(slots[i].url, url) == 0) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+/* Oldest finished slot, preferring failures over stored pages */
+static PrefetchSlot *oldest_finished(bool ready_only) {
+    PrefetchSlot *oldest = NULL;
+    for (int pass = ready_only ? 1 : 0; pass < 2 && !oldest; pass++) {
+        SlotState state = pass == 0 ? SLOT_FAILED : SLOT_READY;
+        for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+            if (slots[i].state == state &&
+                (!oldest || (Sint32)(slots[i].stored_at - oldest->stored_at) < 0)) {
+                oldest = &slots[i];
+            }
+        }
+    }
+    return oldest;
+}
+
+static PrefetchSlot *free_slot(void) {
+    for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+        if (slots[i].state == SLOT_EMPTY) return &slots[i];
+    }
+
+    PrefetchSlot *victim = oldest_finished(false);
+    if (victim) slot_drop(victim);
+    return victim;
+}
+
+PrefetchResult prefetch_start(const Url *url) {
+    if (!url) return PREFETCH_SKIPPED;
+
+    expire_slots();
+    if (find_slot(url->full)) return PREFETCH_SKIPPED;
+    if (unreachable_check(url->host, url->port, NULL, NULL)) {
+        stats.unreachable++;
+        return PREFETCH_SKIPPED;
+    }
+
+    int in_flight = 0, host_in_flight = 0;
+    for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+        if (slots[i].state != SLOT_LOADING) continue;
+        in_flight++;
+        if (strcmp(slots[i].req->url.host, url->host) == 0) host_in_flight++;
+    }
+    if (in_flight >= PREFETCH_MAX_INFLIGHT) return PREFETCH_FULL;
+    if (host_in_flight >= PREFETCH_MAX_PER_HOST) return PREFETCH_SKIPPED;
+
+    PrefetchSlot *slot = free_slot();
+    if (!slot) return PREFETCH_FULL;
+
+    GeminiRequestOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = GEMINI_FETCH_TEXT_ONLY | GEMINI_FETCH_SMALL;
+    opts.priority = GEMINI_PRIORITY_PREFETCH;
+    slot->req = gemini_fetch_async_ex(url, &opts);
+    if (!slot->req) return PREFETCH_FULL;
+
+    slot->state = SLOT_LOADING;
+    strncpy(slot->url, url->full, sizeof(slot->url) - 1);
+    stats.started++;
+    return PREFETCH_STARTED;
+}
+
+bool prefetch_touch(const Url *url) {
+    if (!url) return false;
+
+    expire_slots();
+    PrefetchSlot *slot = find_slot(url->full);
+    if (slot && slot->state != SLOT_FAILED) return true;
+    if (unreachable_check(url->host, url->port, NULL, NULL)) {
+        stats.unreachable++;
+        return false;
+    }
+    if (slot) {
+        /* A failed prefetch is worth another try now the user wants it */
+        slot_clear(slot);
+    }
+    else {
+        slot = free_slot();
+        if (!slot) return false;
+    }
+
+    /* Not GEMINI_FETCH_SMALL - this is likely to be the page itself. Still
+     * a prefetch until the tap adopts it, so a touch that turns into a
+     * scroll doesn't pause downloads. */
+    GeminiRequestOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = GEMINI_FETCH_TEXT_ONLY;
+    opts.priority = GEMINI_PRIORITY_PREFETCH;
+    slot->req = gemini_fetch_async_ex(url, &opts);
+    if (!slot->req) return false;
+
+    slot->state = SLOT_LOADING;
+    slot->touch = true;
+    strncpy(slot->url, url->full, sizeof(slot->url) - 1);
+    stats.touch_started++;
+    return true;
+}
+
+void prefetch_touch_cancel(void) {
+    for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+        PrefetchSlot *slot = &slots[i];
+        if (!slot->touch) continue;
+
+        if (slot->state == SLOT_LOADING) {
+            /* Freed by the caller when it completes */
+            gemini_fetch_cancel(slot->req);
+            slot_clear(slot);
+            stats.touch_cancelled++;
+            continue;
+        }
+
+        /* Already answered - keep it only if it's a page the store would
+         * have taken from an ordinary prefetch */
+        slot->touch = false;
+        if (slot->state == SLOT_READY &&
+            (gemini_status_category(slot->resp->status) != 2 || stored_bytes > PREFETCH_MAX_BYTES)) {
+            slot_drop(slot);
+        }
+    }
+}
+
+bool prefetch_done(GeminiRequest *req) {
+    PrefetchSlot *slot = NULL;
+    for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+        if (slots[i].state == SLOT_LOADING && slots[i].req == req) {
+            slot = &slots[i];
+            break;
+        }
+    }
+    if (!slot) return false;
+
+    GeminiResponse *resp = req->response;
+    req->response = NULL;
+    gemini_request_free(req);
+    slot->req = NULL;
+    slot->stored_at = SDL_GetTicks();
+
+    /* Only pages that can be shown as-is are worth keeping. Redirects are
+     * followed by a real navigation. A touch keeps any server answer,
+     * local errors are retried by the navigation. */
+    bool keep = slot->touch ? resp && resp->status >= 10
+                            : resp && gemini_status_category(resp->status) == 2 &&
+                              resp->body && !resp->truncated;
+    if (!keep) {
+        gemini_response_free(resp);
+        slot->state = SLOT_FAILED;
+        stats.discarded++;
+        return true;
+    }
+
+    while (stored_bytes + resp->body_len > PREFETCH_MAX_BYTES) {
+        PrefetchSlot *victim = oldest_finished(true);
+        if (!victim) break;
+        slot_drop(victim);
+    }
+
+    slot->state = SLOT_READY;
+    slot->resp = resp;
+    stored_bytes += resp->body_len;
+    stats.stored++;
+    return true;
+}
+
+GeminiResponse *prefetch_take(const Url *url) {
+    if (!url) return NULL;
+
+    expire_slots();
+    PrefetchSlot *slot = find_slot(url->full);
+    if (!slot || slot->state != SLOT_READY) return NULL;
+
+    GeminiResponse *resp = slot->resp;
+    stored_bytes -= resp->body_len;
+    slot->resp = NULL;
+    slot_clear(slot);
+    stats.served++;
+    return resp;
+}
+
+GeminiRequest *prefetch_adopt(const Url *url) {
+    if (!url) return NULL;
+
+    PrefetchSlot *slot = find_slot(url->full);
+    if (!slot || slot->state != SLOT_LOADING) return NULL;
+
+    GeminiRequest *req = slot->req;
+    slot->req = NULL;
+    slot_clear(slot);
+    stats.adopted++;
+    return req;
+}
+
+void prefetch_cancel_all(void) {
+    for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+        if (slots[i].state == SLOT_LOADING) {
+            /* Freed by the caller when it completes */
+            gemini_fetch_cancel(slots[i].req);
+            slot_clear(&slots[i]);
+        }
+    }
+}
+
+void prefetch_clear(void) {
+    prefetch_cancel_all();
+    for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+        slot_clear(&slots[i]);
+    }
+}
+
+void prefetch_stats(PrefetchStats *out) {
+    if (!out) return;
+
+    *out = stats;
+    out->entries = 0;
+    out->in_flight = 0;
+    for (int i = 0; i < PREFETCH_MAX_ENTRIES; i++) {
+        if (slots[i].state == SLOT_READY) out->entries++;
+        if (slots[i].state == SLOT_LOADING) out->in_flight++;
+    }
+    out->bytes = stored_bytes;
+}
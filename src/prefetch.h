@@ -0,0 +1,73 @@
+/* Gemini Browser - Speculative prefetch of visible links */
+#ifndef PALMINI_PREFETCH_H
+#define PALMINI_PREFETCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "gemini.h"
+#include "url.h"
+
+#define PREFETCH_MAX_INFLIGHT     2                 /* Prefetches running at once */
+#define PREFETCH_MAX_PER_HOST     1                 /* ...of which to the same host */
+#define PREFETCH_MAX_ENTRIES      16                /* Stored, failed and in-flight */
+#define PREFETCH_MAX_BYTES        (512 * 1024)      /* Stored bodies in total */
+#define PREFETCH_TTL_MS           (2 * 60 * 1000)   /* Before an entry is dropped */
+#define PREFETCH_IDLE_MS          500               /* Stillness before prefetching */
+
+typedef enum {
+    PREFETCH_STARTED,
+    PREFETCH_SKIPPED,   /* Already stored or loading, or its host is busy */
+    PREFETCH_FULL       /* PREFETCH_MAX_INFLIGHT reached */
+} PrefetchResult;
+
+typedef struct {
+    unsigned long started;
+    unsigned long stored;
+    unsigned long served;       /* Opened straight from the store */
+    unsigned long adopted;      /* Opened while still loading */
+    unsigned long discarded;    /* Failed, not text, or too large */
+    unsigned long wasted;       /* Stored but expired or evicted unused */
+    unsigned long touch_started;    /* Started when a finger landed on a link */
+    unsigned long touch_cancelled;  /* ...and cancelled because no tap followed */
+    unsigned long unreachable;      /* Skipped, the host failed recently */
+    int entries;
+    int in_flight;
+    size_t bytes;
+} PrefetchStats;
+
+/* All prefetch functions are called from the UI thread. Prefetch requests
+ * complete through the gemini.c completion queue like any other. */
+
+/* Start fetching url in the background */
+PrefetchResult prefetch_start(const Url *url);
+
+/* Start fetching the link under a finger that just touched down, ahead
+ * of the tap being recognised. Ignores the prefetch limits and keeps
+ * whatever the server answers, since it is probably about to be opened.
+ * Returns false if the fetch couldn't be started. */
+bool prefetch_touch(const Url *url);
+
+/* The touch became a drag or long press - cancel prefetch_touch() */
+void prefetch_touch_cancel(void);
+
+/* Handle a finished request. Returns false if req isn't a prefetch, in
+ * which case the caller still owns it. */
+bool prefetch_done(GeminiRequest *req);
+
+/* Remove and return the stored response for url, or NULL */
+GeminiResponse *prefetch_take(const Url *url);
+
+/* Remove and return the in-flight prefetch of url, or NULL. Its
+ * completion then belongs to the caller. */
+GeminiRequest *prefetch_adopt(const Url *url);
+
+/* Cancel prefetches still in flight, keeping stored responses */
+void prefetch_cancel_all(void);
+
+/* Cancel everything and free stored responses */
+void prefetch_clear(void);
+
+/* Get a snapshot of the counters */
+void prefetch_stats(PrefetchStats *stats);
+
+#endif /* PALMINI_PREFETCH_H */
@@ -0,0 +1,269 @@
+/* Gemini Browser - Memo of permanent redirects */
+#define _GNU_SOURCE
+#include "redirect.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <time.h>
+
+/* On-disk format: magic, entry count, then per entry source length
+ * (u16), source, target length (u16), target, last_used (u32) */
+#define REDIRECT_FILE_MAGIC 0x47524431  /* "GRD1" */
+
+typedef struct {
+    char *from;                 /* Key form, see make_key() */
+    char *to;                   /* Full target URL */
+    uint32_t hash;              /* Of from */
+    uint32_t last_used;         /* time() it was stored or followed */
+} RedirectEntry;
+
+static RedirectEntry entries[REDIRECT_MAX];
+static int num_entries = 0;
+static bool dirty = false;
+static char memo_path[256];
+static RedirectStats stats;
+
+/* Same URL as far as the server is concerned: scheme case and the
+ * fragment don't matter */
+static void make_key(char *key, const char *url) {
+    strncpy(key, url, MAX_URL_LENGTH - 1);
+    key[MAX_URL_LENGTH - 1] = '\0';
+
+    char *sep = strstr(key, "://");
+    for (char *c = key; sep && c < sep; c++) {
+        *c = tolower((unsigned char)*c);
+    }
+
+    char *fragment = strchr(key, '#');
+    if (fragment) *fragment = '\0';
+}
+
+/* FNV-1a */
+static uint32_t hash_key(const char *key) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int find_entry(const char *key) {
+    uint32_t h = hash_key(key);
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].hash == h && strcmp(entries[i].from, key) == 0) return i;
+    }
+    return -1;
+}
+
+static void remove_entry(int index) {
+    free(entries[index].from);
+    free(entries[index].to);
+    entries[index] = entries[num_entries - 1];
+    num_entries--;
+    dirty = true;
+}
+
+/* Store from -> to, replacing the least recently used entry if full */
+static void insert_entry(const char *key, const char *to, uint32_t last_used) {
+    int index = find_entry(key);
+    if (index >= 0) remove_entry(index);
+
+    if (num_entries == REDIRECT_MAX) {
+        index = 0;
+        for (int i = 1; i < num_entries; i++) {
+            if (entries[i].last_used < entries[index].last_used) index = i;
+        }
+        remove_entry(index);
+    }
+
+    char *from_copy = strdup(key);
+    char *to_copy = strdup(to);
+    if (!from_copy || !to_copy) {
+        free(from_copy);
+        free(to_copy);
+        return;
+    }
+
+    RedirectEntry *e = &entries[num_entries++];
+    e->from = from_copy;
+    e->to = to_copy;
+    e->hash = hash_key(key);
+    e->last_used = last_used;
+    dirty = true;
+}
+
+static bool read_string(FILE *f, char *buf) {
+    uint16_t len;
+    if (fread(&len, sizeof(len), 1, f) != 1 || len == 0 || len >= MAX_URL_LENGTH) return false;
+    if (fread(buf, 1, len, f) != len) return false;
+    buf[len] = '\0';
+    return true;
+}
+
+static bool write_string(FILE *f, const char *s) {
+    uint16_t len = (uint16_t)strlen(s);
+    return fwrite(&len, sizeof(len), 1, f) == 1 && fwrite(s, 1, len, f) == len;
+}
+
+static void load_file(void) {
+    FILE *f = fopen(memo_path, "rb");
+    if (!f) return;
+
+    uint32_t magic = 0, count = 0;
+    if (fread(&magic, sizeof(magic), 1, f) != 1 || magic != REDIRECT_FILE_MAGIC ||
+        fread(&count, sizeof(count), 1, f) != 1) {
+        fclose(f);
+        return;
+    }
+
+    char from[MAX_URL_LENGTH], to[MAX_URL_LENGTH];
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t last_used;
+        if (!read_string(f, from) || !read_string(f, to) ||
+            fread(&last_used, sizeof(last_used), 1, f) != 1) {
+            break;
+        }
+        insert_entry(from, to, last_used);
+    }
+
+    fclose(f);
+}
+
+bool redirect_init(const char *path) {
+    if (!path) return false;
+
+    redirect_cleanup();
+    strncpy(memo_path, path, sizeof(memo_path) - 1);
+    memset(&stats, 0, sizeof(stats));
+    load_file();
+    dirty = false;
+    return true;
+}
+
+void redirect_cleanup(void) {
+    redirect_save();
+    while (num_entries > 0) {
+        remove_entry(num_entries - 1);
+    }
+    dirty = false;
+}
+
+bool redirect_save(void) {
+    if (!dirty || !memo_path[0]) return true;
+
+    /* Write to a temporary file and rename, so a crash never leaves a
+     * half-written memo behind */
+    char tmp_path[sizeof(memo_path) + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", memo_path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) return false;
+
+    uint32_t magic = REDIRECT_FILE_MAGIC;
+    uint32_t count = (uint32_t)num_entries;
+    bool ok = fwrite(&magic, sizeof(magic), 1, f) == 1 &&
+              fwrite(&count, sizeof(count), 1, f) == 1;
+    for (int i = 0; ok && i < num_entries; i++) {
+        ok = write_string(f, entries[i].from) && write_string(f, entries[i].to) &&
+             fwrite(&entries[i].last_used, sizeof(entries[i].last_used), 1, f) == 1;
+    }
+
+    if (fclose(f) != 0) ok = false;
+    if (ok && rename(tmp_path, memo_path) == 0) {
+        dirty = false;
+    }
+    else {
+        remove(tmp_path);
+        ok = false;
+    }
+    return ok;
+}
+
+void redirect_remember(const Url *from, const Url *to) {
+    if (!from || !to) return;
+
+    char from_key[MAX_URL_LENGTH], to_key[MAX_URL_LENGTH];
+    make_key(from_key, from->full);
+    make_key(to_key, to->full);
+    if (strcmp(from_key, to_key) == 0) return;
+
+    insert_entry(from_key, to->full, (uint32_t)time(NULL));
+    stats.remembered++;
+}
+
+void redirect_forget(const Url *from) {
+    if (!from) return;
+
+    char key[MAX_URL_LENGTH];
+    make_key(key, from->full);
+    int index = find_entry(key);
+    if (index >= 0) remove_entry(index);
+}
+
+/* Walk the chain starting at url. Each hop looks its target up again,
+ * so A -> B -> C is followed to C without fetching B. */
+static bool follow(const Url *url, Url *out) {
+    char key[MAX_URL_LENGTH];
+    make_key(key, url->full);
+    int index = find_entry(key);
+    if (index < 0) return false;
+
+    int visited[REDIRECT_MAX_CHAIN];
+    int hops = 0;
+    char target[MAX_URL_LENGTH];
+    while (index >= 0 && hops < REDIRECT_MAX_CHAIN) {
+        for (int i = 0; i < hops; i++) {
+            if (visited[i] != index) continue;
+
+            /* The chain loops - drop all of it and let the server decide.
+             * Highest index first, as removal moves the last entry. */
+            for (int a = 0; a < hops; a++) {
+                for (int b = a + 1; b < hops; b++) {
+                    if (visited[b] > visited[a]) {
+                        int t = visited[a];
+                        visited[a] = visited[b];
+                        visited[b] = t;
+                    }
+                }
+            }
+            for (int a = 0; a < hops; a++) {
+                remove_entry(visited[a]);
+            }
+            stats.loops++;
+            return false;
+        }
+        visited[hops++] = index;
+
+        RedirectEntry *e = &entries[index];
+        e->last_used = (uint32_t)time(NULL);
+        strncpy(target, e->to, sizeof(target) - 1);
+        target[sizeof(target) - 1] = '\0';
+
+        make_key(key, target);
+        index = find_entry(key);
+    }
+
+    if (!url_parse(target, out)) return false;
+    stats.rewrites++;
+    return true;
+}
+
+bool redirect_apply(const Url *url, Url *out) {
+    if (!url || !out || num_entries == 0) return false;
+    return follow(url, out);
+}
+
+bool redirect_apply_link(const Url *url, Url *out) {
+    if (!redirect_apply(url, out)) return false;
+    stats.links++;
+    return true;
+}
+
+void redirect_stats(RedirectStats *out) {
+    if (!out) return;
+
+    *out = stats;
+    out->entries = num_entries;
+}
@@ -0,0 +1,49 @@
+/* Gemini Browser - Memo of permanent redirects */
+#ifndef PALMINI_REDIRECT_H
+#define PALMINI_REDIRECT_H
+
+#include <stdbool.h>
+#include "url.h"
+
+#define REDIRECT_MAX        64      /* Remembered redirects */
+#define REDIRECT_MAX_CHAIN  5       /* Hops followed for one navigation */
+#define REDIRECT_FILE       "/media/internal/gemini-redirects.dat"
+
+typedef struct {
+    unsigned long remembered;   /* 31 responses stored */
+    unsigned long rewrites;     /* URLs sent straight to their new home */
+    unsigned long links;        /* ...of which links in a page */
+    unsigned long loops;        /* Chains dropped for looping */
+    int entries;
+} RedirectStats;
+
+/* The memo is only used from the UI thread. A URL that answered 31 is
+ * rewritten to its target before it is fetched again. */
+
+/* Load the redirects saved at path */
+bool redirect_init(const char *path);
+
+/* Save and forget all redirects */
+void redirect_cleanup(void);
+
+/* Write the memo to disk if it changed */
+bool redirect_save(void);
+
+/* Remember that from moved permanently to to */
+void redirect_remember(const Url *from, const Url *to);
+
+/* Forget where from moved to, e.g. because the chain loops */
+void redirect_forget(const Url *from);
+
+/* Follow remembered redirects from url, up to REDIRECT_MAX_CHAIN hops.
+ * Returns true and sets *out if url moved. A chain that comes back on
+ * itself is forgotten. */
+bool redirect_apply(const Url *url, Url *out);
+
+/* redirect_apply() for a link in a page, counted separately */
+bool redirect_apply_link(const Url *url, Url *out);
+
+/* Get a snapshot of the counters */
+void redirect_stats(RedirectStats *stats);
+
+#endif /* PALMINI_REDIRECT_H */
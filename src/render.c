@@ -119,6 +119,7 @@ void render_clear(Renderer *r) {
     SDL_FillRect(r->screen, &rect, color);
 
     r->num_rendered = 0;
+    r->outline_available = false;
 }
 
 static void add_rendered_line(Renderer *r, int x, int y, int w, int h, int doc_index, bool is_link) {
@@ -210,31 +211,58 @@ static void render_text_wrapped(Renderer *r, TTF_Font *font, const char *text,
     *out_height = total_height > 0 ? total_height : line_skip;
 }
 
+/* Height of a line scrolled past above the viewport: one line in its
+ * font, plus the space above a heading */
+static int estimated_height(const Renderer *r, const DocLine *line) {
+    switch (line->type) {
+        case LINE_HEADING1: return TTF_FontLineSkip(r->font_h1) + 8;
+        case LINE_HEADING2: return TTF_FontLineSkip(r->font_h2) + 6;
+        case LINE_HEADING3: return TTF_FontLineSkip(r->font_h3) + 4;
+        case LINE_PREFORMATTED: return r->mono_line_height;
+        default: return r->line_height;
+    }
+}
+
+void render_layout(Renderer *r, Document *doc) {
+    if (!r || !doc) return;
+
+    for (; doc->layout_lines < doc->num_lines; doc->layout_lines++) {
+        if (doc->layout_headings < doc->num_headings &&
+            doc->headings[doc->layout_headings].line == doc->layout_lines) {
+            doc->headings[doc->layout_headings++].y = doc->layout_height;
+        }
+        doc->layout_height += estimated_height(r, &doc->lines[doc->layout_lines]) + LINE_SPACING;
+    }
+}
+
 void render_document(Renderer *r, const Document *doc, int scroll_y) {
     if (!r || !doc) return;
 
     render_clear(r);
+    r->outline_available = doc->num_headings > 0;
 
     int y = MARGIN_TOP - scroll_y;
     int max_width = r->screen->w - MARGIN_LEFT - MARGIN_RIGHT;
+    size_t first = 0;
 
     r->num_rendered = 0;
 
-    for (size_t i = 0; i < doc->num_lines; i++) {
+    /* Lines more than 100 pixels above the viewport are skipped at their
+     * estimated height. Start at the last heading that far up, where the
+     * layout already knows the sum, instead of adding up from the top. */
+    int heading = document_heading_before(doc, scroll_y - MARGIN_TOP - 100);
+    if (heading >= 0) {
+        first = doc->headings[heading].line;
+        y += doc->headings[heading].y;
+    }
+
+    for (size_t i = first; i < doc->num_lines; i++) {
         const DocLine *line = &doc->lines[i];
         int line_height = 0;
 
         /* Skip if completely above viewport */
         if (y + 100 < 0) {
-            /* Estimate height and skip */
-            switch (line->type) {
-                case LINE_HEADING1: line_height = TTF_FontLineSkip(r->font_h1) + 8; break;
-                case LINE_HEADING2: line_height = TTF_FontLineSkip(r->font_h2) + 6; break;
-                case LINE_HEADING3: line_height = TTF_FontLineSkip(r->font_h3) + 4; break;
-                case LINE_PREFORMATTED: line_height = r->mono_line_height; break;
-                default: line_height = r->line_height; break;
-            }
-            y += line_height + LINE_SPACING;
+            y += estimated_height(r, line) + LINE_SPACING;
             continue;
         }
 
@@ -307,8 +335,8 @@ void render_document(Renderer *r, const Document *doc, int scroll_y) {
                 break;
         }
 
-        const char *text = line->text;
-        if (!text || !*text) {
+        const char *text = document_line_text(doc, line);
+        if (!*text) {
             /* Empty line */
             line_height = TTF_FontLineSkip(font);
         }
@@ -343,6 +371,7 @@ void render_document(Renderer *r, const Document *doc, int scroll_y) {
 #define BTN_URL_X       45
 #define BTN_BOOKMARK_W  40
 #define BTN_STAR_W      35
+#define BTN_OUTLINE_W   35
 
 void render_address_bar(Renderer *r, const char *url, bool loading, bool focused, bool can_go_back) {
     if (!r) return;
@@ -373,8 +402,9 @@ void render_address_bar(Renderer *r, const char *url, bool loading, bool focused
     Uint32 border_color = SDL_MapRGB(r->screen->format, 0x50, 0x50, 0x58);
     SDL_FillRect(r->screen, &border, border_color);
 
-    /* Bookmark buttons position on right */
+    /* Bookmark buttons position on right, outline button before them */
     int btn_x = screen_w - BTN_STAR_W - BTN_BOOKMARK_W - 10;
+    int outline_x = btn_x - BTN_OUTLINE_W;
 
     /* Draw highlight backgrounds */
     Uint32 highlight_color = SDL_MapRGB(r->screen->format, 0x50, 0x50, 0x60);
@@ -387,6 +417,9 @@ void render_address_bar(Renderer *r, const char *url, bool loading, bool focused
     } else if (highlight == 3) {
         SDL_Rect hl = { btn_x + BTN_BOOKMARK_W, 2, BTN_STAR_W, MARGIN_TOP - 9 };
         SDL_FillRect(r->screen, &hl, highlight_color);
+    } else if (highlight == 4) {
+        SDL_Rect hl = { outline_x, 2, BTN_OUTLINE_W, MARGIN_TOP - 9 };
+        SDL_FillRect(r->screen, &hl, highlight_color);
     }
 
     /* Back button */
@@ -446,8 +479,21 @@ void render_address_bar(Renderer *r, const char *url, bool loading, bool focused
         }
     }
 
-    /* URL text - between back button and bookmark buttons */
-    int url_max_w = btn_x - BTN_URL_X - 10;
+    /* Outline button, dimmed on pages without headings */
+    {
+        SDL_Color color = r->outline_available ?
+            (SDL_Color){ COLOR_HEADING_R, COLOR_HEADING_G, COLOR_HEADING_B, 255 } :
+            (SDL_Color){ 0x55, 0x55, 0x55, 255 };
+        SDL_Surface *text = TTF_RenderUTF8_Blended(r->font_regular, "\xC2\xA7", color);
+        if (text) {
+            SDL_Rect dest = { outline_x + (BTN_OUTLINE_W - text->w) / 2, 10, text->w, text->h };
+            SDL_BlitSurface(text, NULL, r->screen, &dest);
+            SDL_FreeSurface(text);
+        }
+    }
+
+    /* URL text - between back button and the buttons on the right */
+    int url_max_w = outline_x - BTN_URL_X - 10;
     if (url && *url && url_max_w > 50) {
         SDL_Color color = { 0xcc, 0xcc, 0xcc, 255 };
         SDL_Surface *text = TTF_RenderUTF8_Blended(r->font_regular, url, color);
@@ -481,6 +527,11 @@ int render_address_bar_hit_test(Renderer *r, int x, int y) {
     int screen_w = r->screen->w;
     int btn_x = screen_w - BTN_STAR_W - BTN_BOOKMARK_W - 10;
 
+    /* Outline button */
+    if (x >= btn_x - BTN_OUTLINE_W && x < btn_x) {
+        return 4;
+    }
+
     /* Back button */
     if (x >= BTN_BACK_X && x < BTN_BACK_X + BTN_BACK_W) {
         return 1;
@@ -500,7 +551,7 @@ int render_address_bar_hit_test(Renderer *r, int x, int y) {
 }
 
 void render_button_highlight(Renderer *r, int button) {
-    if (!r || button < 1 || button > 3) return;
+    if (!r || button < 1 || button > 4) return;
     r->highlight_button = button;
     r->highlight_time = SDL_GetTicks();
 }
@@ -567,6 +618,94 @@ int render_hit_test(Renderer *r, int x, int y) {
     return -1;
 }
 
+/* Outline overlay geometry */
+#define OUTLINE_MARGIN      20
+#define OUTLINE_PADDING     10
+#define OUTLINE_INDENT      20      /* Per heading level below 1 */
+
+static int outline_entry_height(const Renderer *r) {
+    return r->line_height + 8;
+}
+
+static SDL_Rect outline_panel(const Renderer *r) {
+    SDL_Rect panel = { OUTLINE_MARGIN, MARGIN_TOP + OUTLINE_MARGIN / 2,
+                       r->screen->w - 2 * OUTLINE_MARGIN,
+                       r->screen->h - MARGIN_TOP - OUTLINE_MARGIN };
+    return panel;
+}
+
+int render_outline_max_scroll(const Renderer *r, const Document *doc) {
+    if (!r || !doc) return 0;
+
+    SDL_Rect panel = outline_panel(r);
+    int height = (int)doc->num_headings * outline_entry_height(r) + 2 * OUTLINE_PADDING;
+    return height > panel.h ? height - panel.h : 0;
+}
+
+int render_outline_scroll_to(const Renderer *r, const Document *doc, int index) {
+    if (!r || !doc || index < 0) return 0;
+
+    SDL_Rect panel = outline_panel(r);
+    int scroll = index * outline_entry_height(r) - panel.h / 2;
+    int max = render_outline_max_scroll(r, doc);
+    return scroll < 0 ? 0 : scroll > max ? max : scroll;
+}
+
+void render_outline(Renderer *r, const Document *doc, int current, int scroll) {
+    if (!r || !doc) return;
+
+    SDL_Rect panel = outline_panel(r);
+    SDL_FillRect(r->screen, &panel, SDL_MapRGB(r->screen->format, 0x28, 0x28, 0x2e));
+    SDL_Rect border = { panel.x, panel.y, panel.w, 1 };
+    Uint32 border_color = SDL_MapRGB(r->screen->format, 0x50, 0x50, 0x58);
+    SDL_FillRect(r->screen, &border, border_color);
+    border.y = panel.y + panel.h - 1;
+    SDL_FillRect(r->screen, &border, border_color);
+
+    SDL_Rect clip;
+    SDL_GetClipRect(r->screen, &clip);
+    SDL_SetClipRect(r->screen, &panel);
+
+    int entry_h = outline_entry_height(r);
+    int first = scroll / entry_h;
+    int y = panel.y + OUTLINE_PADDING + first * entry_h - scroll;
+    for (size_t i = (size_t)first; i < doc->num_headings && y < panel.y + panel.h; i++) {
+        const DocHeading *heading = &doc->headings[i];
+        const char *text = document_line_text(doc, &doc->lines[heading->line]);
+
+        if ((int)i == current) {
+            SDL_Rect hl = { panel.x + 1, y, panel.w - 2, entry_h };
+            SDL_FillRect(r->screen, &hl, SDL_MapRGB(r->screen->format, 0x3a, 0x3a, 0x44));
+        }
+
+        SDL_Color color = (int)i == current ?
+            (SDL_Color){ COLOR_HEADING_R, COLOR_HEADING_G, COLOR_HEADING_B, 255 } :
+            (SDL_Color){ COLOR_TEXT_R, COLOR_TEXT_G, COLOR_TEXT_B, 255 };
+        SDL_Surface *surface = *text ? TTF_RenderUTF8_Blended(r->font_regular, text, color) : NULL;
+        if (surface) {
+            SDL_Rect dest = { panel.x + OUTLINE_PADDING + (heading->level - 1) * OUTLINE_INDENT,
+                              y + (entry_h - surface->h) / 2, surface->w, surface->h };
+            SDL_BlitSurface(surface, NULL, r->screen, &dest);
+            SDL_FreeSurface(surface);
+        }
+        y += entry_h;
+    }
+
+    SDL_SetClipRect(r->screen, &clip);
+}
+
+int render_outline_hit_test(Renderer *r, const Document *doc, int scroll, int x, int y) {
+    if (!r || !doc) return -1;
+
+    SDL_Rect panel = outline_panel(r);
+    if (x < panel.x || x >= panel.x + panel.w || y < panel.y || y >= panel.y + panel.h) return -1;
+
+    int offset = y - panel.y - OUTLINE_PADDING + scroll;
+    if (offset < 0) return -1;
+    size_t index = (size_t)(offset / outline_entry_height(r));
+    return index < doc->num_headings ? (int)index : -1;
+}
+
 void render_flip(Renderer *r) {
     if (!r || !r->screen) return;
     SDL_Flip(r->screen);
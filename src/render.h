@@ -64,6 +64,9 @@ typedef struct {
     /* Total content height (for scrolling) */
     int content_height;
 
+    /* The page on screen has headings to show in the outline */
+    bool outline_available;
+
     /* Button icons (NULL if not loaded, falls back to text) */
     SDL_Surface *icon_back;
     SDL_Surface *icon_bookmark_add;
@@ -83,13 +86,32 @@ void render_cleanup(Renderer *r);
 /* Clear the screen */
 void render_clear(Renderer *r);
 
-/* Render a document at the given scroll offset */
+/* Lay out lines added to doc since the last call, giving each heading
+ * its offset from the top of the page. Only uses font metrics, so a
+ * streamed document can be laid out as it grows. */
+void render_layout(Renderer *r, Document *doc);
+
+/* Render a document at the given scroll offset. Lay it out first. */
 void render_document(Renderer *r, const Document *doc, int scroll_y);
 
+/* Render the outline of doc over the page, scrolled by scroll pixels,
+ * with heading current highlighted */
+void render_outline(Renderer *r, const Document *doc, int current, int scroll);
+
+/* Furthest the outline of doc can be scrolled */
+int render_outline_max_scroll(const Renderer *r, const Document *doc);
+
+/* Outline scroll that brings heading index into the middle */
+int render_outline_scroll_to(const Renderer *r, const Document *doc, int index);
+
+/* Heading under a screen position in the outline, or -1 */
+int render_outline_hit_test(Renderer *r, const Document *doc, int scroll, int x, int y);
+
 /* Render the address bar */
 void render_address_bar(Renderer *r, const char *url, bool loading, bool focused, bool can_go_back);
 
-/* Address bar button hit test - returns: 0=none, 1=back, 2=add bookmark, 3=show bookmarks */
+/* Address bar button hit test - returns: 0=none, 1=back, 2=add bookmark, 3=show bookmarks,
+ * 4=outline */
 int render_address_bar_hit_test(Renderer *r, int x, int y);
 
 /* Trigger button highlight feedback */
@@ -0,0 +1,323 @@
+/* Gemini Browser - Asynchronous DNS resolver with address cache */
+#define _GNU_SOURCE
+#include "resolver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+
+typedef struct {
+    char host[256];
+    ResolvedAddrs addrs;
+    Uint32 expires;
+    Uint32 last_used;
+} CacheEntry;
+
+/* A lookup shared by everyone waiting on the same host */
+struct ResolveJob {
+    char host[256];
+    int refs;               /* Waiters still interested */
+    bool done;
+    bool ok;
+    ResolvedAddrs addrs;
+    struct ResolveJob *next;
+};
+
+static CacheEntry cache[RESOLVER_CACHE_SIZE];
+static int cache_count = 0;
+
+static ResolveJob *queued = NULL;       /* Waiting for a thread */
+static ResolveJob *running = NULL;      /* In getaddrinfo */
+
+static SDL_mutex *lock = NULL;
+static SDL_cond *job_ready = NULL;
+static SDL_Thread *threads[RESOLVER_THREADS];
+static bool quitting = false;
+static void (*notify_done)(void) = NULL;
+static ResolverStats stats;
+
+/* Wraparound-safe "a is at or after b" for SDL_GetTicks() values */
+static bool ticks_reached(Uint32 a, Uint32 b) {
+    return (Sint32)(a - b) >= 0;
+}
+
+static CacheEntry *cache_find(const char *host) {
+    for (int i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i].host, host) == 0) return &cache[i];
+    }
+    return NULL;
+}
+
+static void cache_store(const char *host, const ResolvedAddrs *addrs) {
+    int family = AF_UNSPEC;
+    CacheEntry *e = cache_find(host);
+    if (e) {
+        /* A refresh keeps what we learned about the host */
+        family = e->addrs.preferred_family;
+    }
+    else {
+        if (cache_count < RESOLVER_CACHE_SIZE) {
+            e = &cache[cache_count++];
+        }
+        else {
+            /* Evict least recently used */
+            e = &cache[0];
+            for (int i = 1; i < cache_count; i++) {
+                if (!ticks_reached(cache[i].last_used, e->last_used)) e = &cache[i];
+            }
+        }
+    }
+
+    strncpy(e->host, host, sizeof(e->host) - 1);
+    e->host[sizeof(e->host) - 1] = '\0';
+    memcpy(&e->addrs, addrs, sizeof(ResolvedAddrs));
+    e->addrs.preferred_family = family;
+    e->last_used = SDL_GetTicks();
+    e->expires = e->last_used + RESOLVER_TTL_MS;
+}
+
+static ResolveJob *find_job(ResolveJob *list, const char *host) {
+    for (; list; list = list->next) {
+        if (strcmp(list->host, host) == 0) return list;
+    }
+    return NULL;
+}
+
+static void unlink_job(ResolveJob **list, ResolveJob *job) {
+    for (ResolveJob **pp = list; *pp; pp = &(*pp)->next) {
+        if (*pp == job) {
+            *pp = job->next;
+            return;
+        }
+    }
+}
+
+static bool run_getaddrinfo(const char *host, ResolvedAddrs *out) {
+    struct addrinfo hints, *res, *rp;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+        return false;
+    }
+
+    out->count = 0;
+    out->preferred_family = AF_UNSPEC;
+    for (rp = res; rp && out->count < RESOLVER_MAX_ADDRS; rp = rp->ai_next) {
+        if (rp->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+        memcpy(&out->addrs[out->count], rp->ai_addr, rp->ai_addrlen);
+        out->addr_lens[out->count] = rp->ai_addrlen;
+        out->count++;
+    }
+
+    freeaddrinfo(res);
+    return out->count > 0;
+}
+
+static int resolver_thread(void *data) {
+    (void)data;
+
+    SDL_LockMutex(lock);
+    while (!quitting) {
+        if (!queued) {
+            SDL_CondWait(job_ready, lock);
+            continue;
+        }
+
+        ResolveJob *job = queued;
+        queued = job->next;
+        job->next = running;
+        running = job;
+
+        SDL_UnlockMutex(lock);
+        ResolvedAddrs addrs;
+        bool ok = run_getaddrinfo(job->host, &addrs);
+        SDL_LockMutex(lock);
+
+        unlink_job(&running, job);
+        job->ok = ok;
+        job->done = true;
+        if (ok) {
+            memcpy(&job->addrs, &addrs, sizeof(ResolvedAddrs));
+            cache_store(job->host, &addrs);
+        }
+        if (notify_done) notify_done();
+
+        if (job->refs == 0) free(job);
+    }
+    SDL_UnlockMutex(lock);
+
+    return 0;
+}
+
+bool resolver_init(void) {
+    lock = SDL_CreateMutex();
+    job_ready = SDL_CreateCond();
+    if (!lock || !job_ready) {
+        resolver_cleanup();
+        return false;
+    }
+
+    quitting = false;
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < RESOLVER_THREADS; i++) {
+        threads[i] = SDL_CreateThread(resolver_thread, NULL);
+        if (!threads[i]) {
+            resolver_cleanup();
+            return false;
+        }
+    }
+    return true;
+}
+
+void resolver_cleanup(void) {
+    if (lock) {
+        SDL_LockMutex(lock);
+        quitting = true;
+        SDL_CondBroadcast(job_ready);
+        SDL_UnlockMutex(lock);
+    }
+
+    /* A thread inside getaddrinfo finishes its lookup before exiting */
+    for (int i = 0; i < RESOLVER_THREADS; i++) {
+        if (threads[i]) {
+            SDL_WaitThread(threads[i], NULL);
+            threads[i] = NULL;
+        }
+    }
+
+    while (queued) {
+        ResolveJob *job = queued;
+        queued = job->next;
+        free(job);
+    }
+    cache_count = 0;
+
+    if (job_ready) SDL_DestroyCond(job_ready);
+    if (lock) SDL_DestroyMutex(lock);
+    job_ready = NULL;
+    lock = NULL;
+}
+
+/* Copy a fresh cache entry for host into out. Called with the lock held. */
+static bool cache_lookup(const char *host, ResolvedAddrs *out) {
+    CacheEntry *e = cache_find(host);
+    if (!e || ticks_reached(SDL_GetTicks(), e->expires)) return false;
+
+    memcpy(out, &e->addrs, sizeof(ResolvedAddrs));
+    e->last_used = SDL_GetTicks();
+    stats.cache_hits++;
+    return true;
+}
+
+/* Join a lookup for host already in progress, or queue a new one. Called
+ * with the lock held. */
+static ResolveJob *join_job(const char *host) {
+    ResolveJob *job = find_job(queued, host);
+    if (!job) job = find_job(running, host);
+    if (job) {
+        stats.coalesced++;
+    }
+    else {
+        job = calloc(1, sizeof(ResolveJob));
+        if (!job) return NULL;
+        strncpy(job->host, host, sizeof(job->host) - 1);
+
+        /* Append so lookups start in request order */
+        ResolveJob **pp = &queued;
+        while (*pp) pp = &(*pp)->next;
+        *pp = job;
+        SDL_CondSignal(job_ready);
+    }
+    job->refs++;
+    return job;
+}
+
+/* Take the outcome of a finished job. Called with the lock held. */
+static ResolveResult job_result(const ResolveJob *job, ResolvedAddrs *out) {
+    if (!job->ok) return RESOLVE_FAILED;
+
+    /* Pick up the preference kept across the refresh */
+    CacheEntry *e = cache_find(job->host);
+    memcpy(out, e ? &e->addrs : &job->addrs, sizeof(ResolvedAddrs));
+    return RESOLVE_OK;
+}
+
+/* Drop a waiter's interest in job. Called with the lock held. */
+static void release_job(ResolveJob *job, ResolveResult result) {
+    job->refs--;
+    if (job->refs == 0 && job->done) free(job);
+
+    if (result == RESOLVE_FAILED) stats.failures++;
+    if (result == RESOLVE_TIMEOUT) stats.timeouts++;
+}
+
+ResolveResult resolver_start(const char *host, ResolvedAddrs *out, ResolveJob **job_out) {
+    if (!host || !out || !job_out || !lock) return RESOLVE_FAILED;
+    *job_out = NULL;
+
+    SDL_LockMutex(lock);
+    stats.lookups++;
+
+    ResolveResult result = RESOLVE_OK;
+    if (!cache_lookup(host, out)) {
+        *job_out = join_job(host);
+        result = *job_out ? RESOLVE_PENDING : RESOLVE_FAILED;
+    }
+    SDL_UnlockMutex(lock);
+
+    return result;
+}
+
+ResolveResult resolver_poll(ResolveJob *job, ResolvedAddrs *out) {
+    if (!job || !out || !lock) return RESOLVE_FAILED;
+
+    SDL_LockMutex(lock);
+    ResolveResult result = RESOLVE_PENDING;
+    if (job->done) {
+        result = job_result(job, out);
+        release_job(job, result);
+    }
+    SDL_UnlockMutex(lock);
+
+    return result;
+}
+
+void resolver_abandon(ResolveJob *job, bool timed_out) {
+    if (!job || !lock) return;
+
+    SDL_LockMutex(lock);
+    release_job(job, timed_out ? RESOLVE_TIMEOUT : RESOLVE_CANCELLED);
+    SDL_UnlockMutex(lock);
+}
+
+void resolver_set_notify(void (*notify)(void)) {
+    if (lock) SDL_LockMutex(lock);
+    notify_done = notify;
+    if (lock) SDL_UnlockMutex(lock);
+}
+
+void resolver_set_preferred_family(const char *host, int family) {
+    if (!host || !lock) return;
+
+    SDL_LockMutex(lock);
+    CacheEntry *e = cache_find(host);
+    if (e) e->addrs.preferred_family = family;
+    SDL_UnlockMutex(lock);
+}
+
+void resolver_stats(ResolverStats *out) {
+    if (!out) return;
+    if (!lock) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    SDL_LockMutex(lock);
+    *out = stats;
+    out->entries = cache_count;
+    SDL_UnlockMutex(lock);
+}
@@ -0,0 +1,73 @@
+/* Gemini Browser - Asynchronous DNS resolver with address cache */
+#ifndef PALMINI_RESOLVER_H
+#define PALMINI_RESOLVER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <SDL.h>
+
+#define RESOLVER_MAX_ADDRS   8
+#define RESOLVER_CACHE_SIZE  64
+#define RESOLVER_TTL_MS      (10 * 60 * 1000)   /* getaddrinfo doesn't expose record TTLs */
+#define RESOLVER_THREADS     2
+
+/* Addresses for a host, port left as 0 */
+typedef struct {
+    struct sockaddr_storage addrs[RESOLVER_MAX_ADDRS];
+    socklen_t addr_lens[RESOLVER_MAX_ADDRS];
+    int count;
+    int preferred_family;       /* Family that last connected, or AF_UNSPEC */
+} ResolvedAddrs;
+
+typedef enum {
+    RESOLVE_OK,
+    RESOLVE_FAILED,     /* Name does not resolve */
+    RESOLVE_TIMEOUT,    /* Deadline passed before the lookup finished */
+    RESOLVE_CANCELLED,
+    RESOLVE_PENDING     /* Still running - poll the job again later */
+} ResolveResult;
+
+/* A lookup in progress, see resolver_start() */
+typedef struct ResolveJob ResolveJob;
+
+typedef struct {
+    unsigned long lookups;
+    unsigned long cache_hits;
+    unsigned long coalesced;    /* Joined a lookup already in progress */
+    unsigned long failures;
+    unsigned long timeouts;
+    int entries;
+} ResolverStats;
+
+/* Start the lookup threads */
+bool resolver_init(void);
+
+/* Stop the lookup threads and drop the cache */
+void resolver_cleanup(void);
+
+/* Non-blocking lookup. Returns RESOLVE_OK with *out filled from the
+ * cache, RESOLVE_FAILED, or RESOLVE_PENDING with *job set. A pending job
+ * is polled with resolver_poll() until it stops returning RESOLVE_PENDING,
+ * or given up with resolver_abandon(). */
+ResolveResult resolver_start(const char *host, ResolvedAddrs *out, ResolveJob **job);
+
+/* Check on a pending job. Once the result is not RESOLVE_PENDING the job
+ * is released and must not be used again. */
+ResolveResult resolver_poll(ResolveJob *job, ResolvedAddrs *out);
+
+/* Stop waiting for a pending job. timed_out counts it as a timeout. */
+void resolver_abandon(ResolveJob *job, bool timed_out);
+
+/* Call notify (on a resolver thread) whenever a lookup finishes, so an
+ * event loop waiting on jobs can wake up. NULL disables it. */
+void resolver_set_notify(void (*notify)(void));
+
+/* Remember which address family last connected to host, so the next
+ * connection tries it first */
+void resolver_set_preferred_family(const char *host, int family);
+
+/* Get a snapshot of the counters */
+void resolver_stats(ResolverStats *stats);
+
+#endif /* PALMINI_RESOLVER_H */
@@ -0,0 +1,372 @@
+/* Gemini Browser - Per-host request scheduling */
+#include "scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <SDL_mutex.h>
+
+typedef struct {
+    char host[256];
+    int active;                 /* Handed out and not finished */
+    int background;             /* ...of which below GEMINI_PRIORITY_INTERACTIVE */
+    Uint32 last_background;     /* When the last background request started */
+    bool background_started;
+    Uint32 blocked_until;       /* End of the last 44's wait */
+    bool blocked;
+    Uint32 last_used;
+} SchedulerHost;
+
+static SchedulerHost hosts[SCHEDULER_MAX_HOSTS];
+static int num_hosts = 0;
+static GeminiRequest *waiting = NULL;       /* Oldest first */
+static int running[GEMINI_PRIORITY_COUNT];  /* Handed out and not finished */
+static Uint32 jitter_state = 1;
+static SchedulerStats stats;
+static SDL_mutex *stats_lock = NULL;
+
+static bool before(Uint32 a, Uint32 b) {
+    return (Sint32)(a - b) < 0;
+}
+
+/* xorshift - rand() is shared with the UI thread */
+static Uint32 jitter(Uint32 range) {
+    jitter_state ^= jitter_state << 13;
+    jitter_state ^= jitter_state >> 17;
+    jitter_state ^= jitter_state << 5;
+    return range ? jitter_state % range : 0;
+}
+
+static bool host_idle(const SchedulerHost *h, Uint32 now) {
+    return h->active == 0 && (!h->blocked || !before(now, h->blocked_until));
+}
+
+/* State for host, created if needed. Returns NULL when every slot is
+ * busy, in which case the host goes unthrottled. */
+static SchedulerHost *find_host(const char *host, bool create) {
+    for (int i = 0; i < num_hosts; i++) {
+        if (strcmp(hosts[i].host, host) == 0) return &hosts[i];
+    }
+    if (!create) return NULL;
+
+    Uint32 now = SDL_GetTicks();
+    int index = -1;
+    if (num_hosts < SCHEDULER_MAX_HOSTS) {
+        index = num_hosts++;
+    }
+    else {
+        for (int i = 0; i < num_hosts; i++) {
+            if (host_idle(&hosts[i], now) &&
+                (index < 0 || before(hosts[i].last_used, hosts[index].last_used))) {
+                index = i;
+            }
+        }
+        if (index < 0) return NULL;
+    }
+
+    SchedulerHost *h = &hosts[index];
+    memset(h, 0, sizeof(*h));
+    strncpy(h->host, host, sizeof(h->host) - 1);
+    h->last_used = now;
+    return h;
+}
+
+static GeminiPriority priority_of(const GeminiRequest *req) {
+    int priority = req->priority;
+    if (priority < 0 || priority >= GEMINI_PRIORITY_COUNT) return GEMINI_PRIORITY_BULK;
+    return (GeminiPriority)priority;
+}
+
+static bool is_background(GeminiPriority priority) {
+    return priority != GEMINI_PRIORITY_INTERACTIVE;
+}
+
+static bool is_cancelled(const GeminiRequest *req) {
+    return req->cancelled || (req->token && req->token->fired);
+}
+
+/* Whether req may start now. Sets *wake to when that may change if it
+ * is waiting on a timer, else leaves it alone. */
+static bool may_start(const GeminiRequest *req, const SchedulerHost *h, Uint32 now, Uint32 *wake) {
+    if (req->retry_at && before(now, req->retry_at)) {
+        *wake = req->retry_at;
+        return false;
+    }
+    GeminiPriority priority = priority_of(req);
+    if (scheduler_should_yield(priority)) return false;
+    if (!h) return true;
+
+    if (h->blocked && before(now, h->blocked_until)) {
+        *wake = h->blocked_until;
+        return false;
+    }
+    if (h->active >= SCHEDULER_MAX_PER_HOST) return false;
+
+    if (is_background(priority)) {
+        if (h->background >= SCHEDULER_BACKGROUND_PER_HOST) return false;
+        Uint32 gap_end = h->last_background + SCHEDULER_BACKGROUND_GAP_MS;
+        if (h->background_started && before(now, gap_end)) {
+            *wake = gap_end;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void update_waiting(void) {
+    int count = 0;
+    int by_class[GEMINI_PRIORITY_COUNT] = { 0 };
+    for (GeminiRequest *r = waiting; r; r = r->next) {
+        count++;
+        by_class[priority_of(r)]++;
+    }
+
+    Uint32 now = SDL_GetTicks();
+    int backing_off = 0;
+    for (int i = 0; i < num_hosts; i++) {
+        if (hosts[i].blocked && before(now, hosts[i].blocked_until)) backing_off++;
+    }
+
+    SDL_LockMutex(stats_lock);
+    stats.waiting = count;
+    stats.backing_off = backing_off;
+    for (int i = 0; i < GEMINI_PRIORITY_COUNT; i++) {
+        stats.classes[i].waiting = by_class[i];
+        stats.classes[i].running = running[i];
+    }
+    SDL_UnlockMutex(stats_lock);
+}
+
+bool scheduler_init(void) {
+    if (!stats_lock) {
+        stats_lock = SDL_CreateMutex();
+        if (!stats_lock) return false;
+    }
+
+    num_hosts = 0;
+    waiting = NULL;
+    memset(running, 0, sizeof(running));
+    jitter_state = SDL_GetTicks() | 1;
+    memset(&stats, 0, sizeof(stats));
+    return true;
+}
+
+void scheduler_cleanup(void) {
+    if (stats_lock) SDL_DestroyMutex(stats_lock);
+    stats_lock = NULL;
+    num_hosts = 0;
+    waiting = NULL;
+}
+
+void scheduler_submit(GeminiRequest *req) {
+    if (!req) return;
+
+    req->next = NULL;
+    GeminiRequest **pp = &waiting;
+    while (*pp) pp = &(*pp)->next;
+    *pp = req;
+
+    if (req->attempts > 0) return;
+    req->queued_at = SDL_GetTicks();
+    SDL_LockMutex(stats_lock);
+    stats.submitted++;
+    SDL_UnlockMutex(stats_lock);
+}
+
+/* Unlink req from the waiting list, hand it out and count it */
+static GeminiRequest *take(GeminiRequest **pp, SchedulerHost *h, Uint32 now) {
+    GeminiRequest *req = *pp;
+    *pp = req->next;
+    req->next = NULL;
+    req->running = true;
+    req->running_as = priority_of(req);
+    req->retry_at = 0;
+    running[req->running_as]++;
+
+    if (req->attempts == 0) {
+        Uint32 waited = now - req->queued_at;
+        SchedulerClassStats *cs = &stats.classes[req->running_as];
+        SDL_LockMutex(stats_lock);
+        cs->started++;
+        cs->wait_ms += waited;
+        if (waited > cs->max_wait_ms) cs->max_wait_ms = waited;
+        SDL_UnlockMutex(stats_lock);
+    }
+
+    if (h) {
+        h->active++;
+        h->last_used = now;
+        if (is_background(req->running_as)) {
+            h->background++;
+            h->last_background = now;
+            h->background_started = true;
+        }
+    }
+    return req;
+}
+
+GeminiRequest *scheduler_next(SchedulerVerdict *verdict) {
+    Uint32 now = SDL_GetTicks();
+
+    /* Most urgent class first, oldest first in each */
+    for (int pass = 0; pass < GEMINI_PRIORITY_COUNT; pass++) {
+        for (GeminiRequest **pp = &waiting; *pp; pp = &(*pp)->next) {
+            GeminiRequest *req = *pp;
+            SchedulerHost *h = find_host(req->url.host, true);
+
+            /* Let these complete, whatever the host's state */
+            if (is_cancelled(req)) {
+                *verdict = SCHEDULER_START;
+                return take(pp, h, now);
+            }
+            if (!before(now, req->deadline)) {
+                *verdict = SCHEDULER_EXPIRED;
+                SDL_LockMutex(stats_lock);
+                stats.given_up++;
+                SDL_UnlockMutex(stats_lock);
+                return take(pp, h, now);
+            }
+            if (h && h->blocked && before(now, h->blocked_until) &&
+                !before(h->blocked_until, req->deadline)) {
+                *verdict = SCHEDULER_BACKED_OFF;
+                SDL_LockMutex(stats_lock);
+                stats.given_up++;
+                SDL_UnlockMutex(stats_lock);
+                return take(pp, h, now);
+            }
+
+            if (priority_of(req) != (GeminiPriority)pass) continue;
+
+            Uint32 wake;
+            if (may_start(req, h, now, &wake)) {
+                *verdict = SCHEDULER_START;
+                return take(pp, h, now);
+            }
+            if (!req->waited && !req->attempts) {
+                req->waited = true;
+                SDL_LockMutex(stats_lock);
+                stats.delayed++;
+                SDL_UnlockMutex(stats_lock);
+            }
+        }
+    }
+
+    update_waiting();
+    return NULL;
+}
+
+/* Seconds to wait from a 44's meta, in ms */
+static Uint32 slow_down_ms(const char *meta) {
+    char *end;
+    long seconds = strtol(meta, &end, 10);
+    if (end == meta || seconds <= 0) return SCHEDULER_SLOW_DOWN_MS;
+    if (seconds > SCHEDULER_SLOW_DOWN_MAX_MS / 1000) return SCHEDULER_SLOW_DOWN_MAX_MS;
+    return (Uint32)seconds * 1000;
+}
+
+bool scheduler_finished(GeminiRequest *req, const GeminiResponse *resp) {
+    if (!req || !req->running) return false;
+    req->running = false;
+    if (running[req->running_as] > 0) running[req->running_as]--;
+
+    Uint32 now = SDL_GetTicks();
+    SchedulerHost *h = find_host(req->url.host, false);
+    if (h && h->active > 0) {
+        h->active--;
+        if (is_background(req->running_as) && h->background > 0) h->background--;
+    }
+
+    /* Only a status the server actually sent says anything about it */
+    if (!resp || is_cancelled(req) || !resp->trace.first_byte) return false;
+
+    Uint32 retry_at;
+    if (resp->status == GM_STATUS_SLOW_DOWN) {
+        Uint32 wait = slow_down_ms(resp->meta);
+        if (h) {
+            h->blocked = true;
+            h->blocked_until = now + wait;
+        }
+        SDL_LockMutex(stats_lock);
+        stats.slow_downs++;
+        SDL_UnlockMutex(stats_lock);
+        retry_at = now + wait;
+    }
+    else if (resp->status == GM_STATUS_TEMP_FAILURE || resp->status == GM_STATUS_SERVER_UNAVAIL) {
+        /* Exponential backoff, with jitter so clients that failed
+         * together don't come back together */
+        Uint32 delay = SCHEDULER_RETRY_BASE_MS << req->attempts;
+        retry_at = now + delay + jitter(delay / 2 + 1);
+    }
+    else {
+        return false;
+    }
+
+    if (req->attempts >= SCHEDULER_MAX_RETRIES || !before(retry_at, req->deadline)) {
+        return false;
+    }
+
+    req->attempts++;
+    req->retry_at = retry_at ? retry_at : 1;
+    scheduler_submit(req);
+
+    SDL_LockMutex(stats_lock);
+    stats.retries++;
+    SDL_UnlockMutex(stats_lock);
+    return true;
+}
+
+void scheduler_reprioritize(GeminiRequest *req) {
+    if (!req || !req->running) return;
+
+    GeminiPriority priority = priority_of(req);
+    if (priority == req->running_as) return;
+
+    running[req->running_as]--;
+    running[priority]++;
+    SchedulerHost *h = find_host(req->url.host, false);
+    if (h && is_background(req->running_as) != is_background(priority)) {
+        if (is_background(priority)) h->background++;
+        else if (h->background > 0) h->background--;
+    }
+    req->running_as = priority;
+}
+
+bool scheduler_should_yield(GeminiPriority priority) {
+    return priority >= GEMINI_PRIORITY_PREFETCH && running[GEMINI_PRIORITY_INTERACTIVE] > 0;
+}
+
+int scheduler_timeout(void) {
+    Uint32 now = SDL_GetTicks();
+    bool any = false;
+    Uint32 earliest = 0;
+
+    for (GeminiRequest *req = waiting; req; req = req->next) {
+        /* Its deadline at the latest, when it gets handed back to expire */
+        Uint32 wake = req->deadline;
+        may_start(req, find_host(req->url.host, false), now, &wake);
+        if (before(req->deadline, wake)) wake = req->deadline;
+
+        if (!any || before(wake, earliest)) earliest = wake;
+        any = true;
+    }
+
+    if (!any) return -1;
+    return before(now, earliest) ? (int)(earliest - now) : 0;
+}
+
+GeminiRequest *scheduler_take_all(void) {
+    GeminiRequest *all = waiting;
+    waiting = NULL;
+    update_waiting();
+    return all;
+}
+
+void scheduler_stats(SchedulerStats *out) {
+    if (!out) return;
+    if (!stats_lock) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    SDL_LockMutex(stats_lock);
+    *out = stats;
+    SDL_UnlockMutex(stats_lock);
+}
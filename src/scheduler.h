@@ -0,0 +1,84 @@
+/* Gemini Browser - Per-host request scheduling */
+#ifndef PALMINI_SCHEDULER_H
+#define PALMINI_SCHEDULER_H
+
+#include <stdbool.h>
+#include <SDL.h>
+#include "gemini.h"
+
+#define SCHEDULER_MAX_HOSTS             32
+#define SCHEDULER_MAX_PER_HOST          4       /* Requests to one host at once */
+#define SCHEDULER_BACKGROUND_PER_HOST   2       /* ...of which background ones */
+#define SCHEDULER_BACKGROUND_GAP_MS     250     /* Between background requests to a host */
+#define SCHEDULER_MAX_RETRIES           2       /* For 40, 41 and 44 */
+#define SCHEDULER_RETRY_BASE_MS         1000    /* First 40/41 retry, doubled each time */
+#define SCHEDULER_SLOW_DOWN_MS          5000    /* A 44 without a usable wait */
+#define SCHEDULER_SLOW_DOWN_MAX_MS      (5 * 60 * 1000)
+
+typedef struct {
+    int waiting;
+    int running;
+    unsigned long started;      /* First attempts only */
+    unsigned long wait_ms;      /* Total time those spent waiting */
+    Uint32 max_wait_ms;
+} SchedulerClassStats;
+
+typedef struct {
+    unsigned long submitted;
+    unsigned long delayed;      /* Had to wait for a slot, the gap or a backoff */
+    unsigned long slow_downs;   /* 44 responses */
+    unsigned long retries;      /* Requests sent again after 40, 41 or 44 */
+    unsigned long given_up;     /* Expired or backed off while waiting */
+    int waiting;
+    int backing_off;            /* Hosts currently under a 44 */
+    SchedulerClassStats classes[GEMINI_PRIORITY_COUNT];
+} SchedulerStats;
+
+/* What to do with a request taken from the scheduler */
+typedef enum {
+    SCHEDULER_START,
+    SCHEDULER_EXPIRED,          /* Its deadline passed while it waited */
+    SCHEDULER_BACKED_OFF        /* The host asked us to wait past its deadline */
+} SchedulerVerdict;
+
+/* Every request passes through the scheduler on its way to a connection.
+ * It holds requests back while their host has too many in flight, keeps
+ * background requests (any priority below GEMINI_PRIORITY_INTERACTIVE)
+ * spaced out, and stops all requests to a host for as long as its last
+ * 44 SLOW DOWN asked. Waiting requests start in priority order. Engine
+ * thread only, apart from scheduler_stats(). */
+
+/* Reset all state */
+bool scheduler_init(void);
+void scheduler_cleanup(void);
+
+/* Queue a newly submitted request */
+void scheduler_submit(GeminiRequest *req);
+
+/* Next request that may run now, or NULL. Cancelled and expired
+ * requests are handed back straight away so they can complete. */
+GeminiRequest *scheduler_next(SchedulerVerdict *verdict);
+
+/* A request handed out by scheduler_next() finished with resp. Returns
+ * true if it was queued again to be retried later, in which case resp
+ * should be discarded instead of delivered. */
+bool scheduler_finished(GeminiRequest *req, const GeminiResponse *resp);
+
+/* Move a running request to the class it was promoted to, if any */
+void scheduler_reprioritize(GeminiRequest *req);
+
+/* Whether requests of priority should hold off for now, because a
+ * navigation is in flight. Applies to prefetch and bulk transfers. */
+bool scheduler_should_yield(GeminiPriority priority);
+
+/* Milliseconds until a waiting request may become runnable without
+ * another one finishing, or -1 if none is waiting on a timer */
+int scheduler_timeout(void);
+
+/* Remove and return all waiting requests, as a list linked by next */
+GeminiRequest *scheduler_take_all(void);
+
+/* Get a snapshot of the counters */
+void scheduler_stats(SchedulerStats *stats);
+
+#endif /* PALMINI_SCHEDULER_H */
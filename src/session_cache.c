@@ -0,0 +1,325 @@
+/* Gemini Browser - TLS session resumption cache */
+#include "session_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/ssl.h>
+#include <SDL.h>
+#include <SDL_mutex.h>
+
+/* On-disk format: magic, entry count, then per entry
+ * key length (u16), key, DER length (u32), DER-encoded SSL_SESSION */
+#define SESSION_FILE_MAGIC  0x47534331  /* "GSC1" */
+#define SESSION_KEY_LEN     272         /* host + ":" + port */
+#define SESSION_DER_MAX     8192
+
+/* Sessions are kept DER-encoded and decoded afresh for every connection.
+ * OpenSSL marks a live SSL_SESSION unresumable when the server closes
+ * without close_notify, which many Gemini servers do. */
+typedef struct {
+    char key[SESSION_KEY_LEN];
+    unsigned char *der;
+    uint32_t der_len;
+    long expires;               /* time() after which the server won't resume */
+    unsigned long last_used;    /* LRU clock value */
+} SessionEntry;
+
+static SessionEntry entries[SESSION_CACHE_MAX];
+static int num_entries = 0;
+static unsigned long lru_clock = 0;
+static bool dirty = false;
+static char cache_path[256];
+static SessionCacheStats stats;
+static SDL_mutex *lock = NULL;
+
+static void make_key(char *key, const char *host, uint16_t port) {
+    snprintf(key, SESSION_KEY_LEN, "%s:%u", host, (unsigned)port);
+}
+
+static int find_entry(const char *key) {
+    for (int i = 0; i < num_entries; i++) {
+        if (strcmp(entries[i].key, key) == 0) return i;
+    }
+    return -1;
+}
+
+static void remove_entry(int index) {
+    free(entries[index].der);
+    entries[index] = entries[num_entries - 1];
+    num_entries--;
+}
+
+static bool entry_expired(const SessionEntry *e) {
+    return e->expires <= (long)time(NULL);
+}
+
+/* Insert or replace key, evicting the least recently used entry if full.
+ * Takes ownership of der. */
+static void insert_entry(const char *key, unsigned char *der, uint32_t der_len, long expires) {
+    int index = find_entry(key);
+    if (index >= 0) {
+        free(entries[index].der);
+    }
+    else if (num_entries < SESSION_CACHE_MAX) {
+        index = num_entries++;
+    }
+    else {
+        index = 0;
+        for (int i = 1; i < num_entries; i++) {
+            if (entries[i].last_used < entries[index].last_used) index = i;
+        }
+        free(entries[index].der);
+    }
+
+    strncpy(entries[index].key, key, SESSION_KEY_LEN - 1);
+    entries[index].key[SESSION_KEY_LEN - 1] = '\0';
+    entries[index].der = der;
+    entries[index].der_len = der_len;
+    entries[index].expires = expires;
+    entries[index].last_used = ++lru_clock;
+}
+
+static long session_expiry(SSL_SESSION *session) {
+    return SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session);
+}
+
+static void load_file(void) {
+    FILE *f = fopen(cache_path, "rb");
+    if (!f) return;
+
+    uint32_t magic = 0, count = 0;
+    if (fread(&magic, sizeof(magic), 1, f) != 1 || magic != SESSION_FILE_MAGIC ||
+        fread(&count, sizeof(count), 1, f) != 1) {
+        fclose(f);
+        return;
+    }
+
+    /* Entries were written oldest first, so inserting in order restores LRU */
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t key_len;
+        uint32_t der_len;
+        char key[SESSION_KEY_LEN];
+
+        if (fread(&key_len, sizeof(key_len), 1, f) != 1 || key_len >= SESSION_KEY_LEN) break;
+        if (fread(key, 1, key_len, f) != key_len) break;
+        key[key_len] = '\0';
+        if (fread(&der_len, sizeof(der_len), 1, f) != 1 || der_len > SESSION_DER_MAX) break;
+
+        unsigned char *der = malloc(der_len);
+        if (!der) break;
+        if (fread(der, 1, der_len, f) != der_len) {
+            free(der);
+            break;
+        }
+
+        /* Validate and read the expiry time */
+        const unsigned char *p = der;
+        SSL_SESSION *session = d2i_SSL_SESSION(NULL, &p, der_len);
+        if (!session) {
+            free(der);
+            continue;
+        }
+        long expires = session_expiry(session);
+        SSL_SESSION_free(session);
+
+        if (expires <= (long)time(NULL)) {
+            free(der);
+            continue;
+        }
+        insert_entry(key, der, der_len, expires);
+    }
+
+    fclose(f);
+}
+
+bool session_cache_init(const char *path) {
+    if (!lock) {
+        lock = SDL_CreateMutex();
+        if (!lock) return false;
+    }
+
+    strncpy(cache_path, path, sizeof(cache_path) - 1);
+    memset(&stats, 0, sizeof(stats));
+    load_file();
+    dirty = false;
+    return true;
+}
+
+void session_cache_cleanup(void) {
+    if (!lock) return;
+
+    session_cache_save();
+
+    SDL_LockMutex(lock);
+    while (num_entries > 0) {
+        remove_entry(num_entries - 1);
+    }
+    SDL_UnlockMutex(lock);
+
+    SDL_DestroyMutex(lock);
+    lock = NULL;
+}
+
+bool session_cache_save(void) {
+    if (!lock) return false;
+
+    SDL_LockMutex(lock);
+    if (!dirty) {
+        SDL_UnlockMutex(lock);
+        return true;
+    }
+
+    /* Write to a temporary file and rename, so a crash never leaves a
+     * half-written cache behind */
+    char tmp_path[sizeof(cache_path) + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        SDL_UnlockMutex(lock);
+        return false;
+    }
+
+    /* Order oldest first */
+    int order[SESSION_CACHE_MAX];
+    for (int i = 0; i < num_entries; i++) order[i] = i;
+    for (int i = 1; i < num_entries; i++) {
+        int v = order[i], j = i;
+        while (j > 0 && entries[order[j - 1]].last_used > entries[v].last_used) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = v;
+    }
+
+    uint32_t magic = SESSION_FILE_MAGIC;
+    uint32_t count = 0;
+    for (int i = 0; i < num_entries; i++) {
+        if (!entry_expired(&entries[i])) count++;
+    }
+    bool ok = fwrite(&magic, sizeof(magic), 1, f) == 1 &&
+              fwrite(&count, sizeof(count), 1, f) == 1;
+
+    for (int i = 0; ok && i < num_entries; i++) {
+        SessionEntry *e = &entries[order[i]];
+        if (entry_expired(e)) continue;
+
+        uint16_t key_len = (uint16_t)strlen(e->key);
+        ok = fwrite(&key_len, sizeof(key_len), 1, f) == 1 &&
+             fwrite(e->key, 1, key_len, f) == key_len &&
+             fwrite(&e->der_len, sizeof(e->der_len), 1, f) == 1 &&
+             fwrite(e->der, 1, e->der_len, f) == e->der_len;
+    }
+
+    if (fclose(f) != 0) ok = false;
+    if (ok && rename(tmp_path, cache_path) == 0) {
+        dirty = false;
+    }
+    else {
+        remove(tmp_path);
+        ok = false;
+    }
+
+    SDL_UnlockMutex(lock);
+    return ok;
+}
+
+bool session_cache_apply(SSL *ssl, const char *host, uint16_t port) {
+    if (!lock || !ssl || !host) return false;
+
+    char key[SESSION_KEY_LEN];
+    make_key(key, host, port);
+
+    bool offered = false;
+    SDL_LockMutex(lock);
+    int index = find_entry(key);
+    if (index >= 0 && entry_expired(&entries[index])) {
+        remove_entry(index);
+        dirty = true;
+        index = -1;
+    }
+    if (index >= 0) {
+        const unsigned char *p = entries[index].der;
+        SSL_SESSION *session = d2i_SSL_SESSION(NULL, &p, entries[index].der_len);
+        if (session) {
+            /* SSL_set_session takes its own reference */
+            offered = SSL_set_session(ssl, session) == 1;
+            SSL_SESSION_free(session);
+        }
+        entries[index].last_used = ++lru_clock;
+    }
+    SDL_UnlockMutex(lock);
+
+    return offered;
+}
+
+void session_cache_store(SSL *ssl, const char *host, uint16_t port, bool offered) {
+    if (!lock || !ssl || !host) return;
+
+    bool resumed = SSL_session_reused(ssl) != 0;
+
+    /* Encode outside the lock */
+    unsigned char *der = NULL;
+    int der_len = 0;
+    long expires = 0;
+    SSL_SESSION *session = SSL_get1_session(ssl);
+    if (session) {
+        der_len = i2d_SSL_SESSION(session, NULL);
+        if (der_len > 0 && der_len <= SESSION_DER_MAX) {
+            der = malloc(der_len);
+            if (der) {
+                unsigned char *p = der;
+                i2d_SSL_SESSION(session, &p);
+            }
+        }
+        expires = session_expiry(session);
+        SSL_SESSION_free(session);
+    }
+
+    char key[SESSION_KEY_LEN];
+    make_key(key, host, port);
+
+    SDL_LockMutex(lock);
+    stats.handshakes++;
+    if (offered) stats.offered++;
+    if (resumed) {
+        stats.hits++;
+    }
+    else {
+        stats.misses++;
+    }
+
+    if (der) {
+        insert_entry(key, der, (uint32_t)der_len, expires);
+        dirty = true;
+    }
+    SDL_UnlockMutex(lock);
+}
+
+void session_cache_remove(const char *host, uint16_t port) {
+    if (!lock || !host) return;
+
+    char key[SESSION_KEY_LEN];
+    make_key(key, host, port);
+
+    SDL_LockMutex(lock);
+    int index = find_entry(key);
+    if (index >= 0) {
+        remove_entry(index);
+        dirty = true;
+    }
+    SDL_UnlockMutex(lock);
+}
+
+void session_cache_stats(SessionCacheStats *out) {
+    if (!out) return;
+    if (!lock) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    SDL_LockMutex(lock);
+    *out = stats;
+    out->entries = num_entries;
+    SDL_UnlockMutex(lock);
+}
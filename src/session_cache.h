@@ -0,0 +1,47 @@
+/* Gemini Browser - TLS session resumption cache */
+#ifndef PALMINI_SESSION_CACHE_H
+#define PALMINI_SESSION_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* OpenSSL's SSL, declared here rather than including <openssl/ssl.h>,
+ * whose UI typedef clashes with ours in ui.c */
+struct ssl_st;
+
+#define SESSION_CACHE_MAX   32
+#define SESSION_CACHE_FILE  "/media/internal/gemini-sessions.dat"
+
+/* Resumption counters since startup */
+typedef struct {
+    unsigned long handshakes;   /* Completed handshakes */
+    unsigned long offered;      /* Handshakes that offered a cached session */
+    unsigned long hits;         /* Offered session accepted by the server */
+    unsigned long misses;       /* Full handshakes */
+    int entries;                /* Sessions currently cached */
+} SessionCacheStats;
+
+/* Initialize the cache and load sessions saved at path */
+bool session_cache_init(const char *path);
+
+/* Save and free all sessions */
+void session_cache_cleanup(void);
+
+/* Write the cache to disk. Safe to call at any time. */
+bool session_cache_save(void);
+
+/* Offer the cached session for host:port on ssl, before SSL_connect.
+ * Returns true if a session was offered. */
+bool session_cache_apply(struct ssl_st *ssl, const char *host, uint16_t port);
+
+/* Remember the session negotiated on ssl, after SSL_connect succeeds.
+ * Also updates the hit/miss counters. */
+void session_cache_store(struct ssl_st *ssl, const char *host, uint16_t port, bool offered);
+
+/* Forget host:port (e.g. after a failed resumption attempt) */
+void session_cache_remove(const char *host, uint16_t port);
+
+/* Get a snapshot of the counters */
+void session_cache_stats(SessionCacheStats *stats);
+
+#endif /* PALMINI_SESSION_CACHE_H */
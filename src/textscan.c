@@ -0,0 +1,66 @@
+/* Gemini Browser - Vectorized text scanning */
+#include "textscan.h"
+#include <stdint.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TEXTSCAN_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTSCAN_SSE2
+#endif
+
+#ifdef TEXTSCAN_NEON
+/* Index of the first set byte of a 0x00/0xFF mask, or 16 if none. ARMv7
+ * has no movemask: narrow each byte to a nibble and count zeros. */
+static int first_set(uint8x16_t mask) {
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(mask), 4);
+    uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+    return bits ? __builtin_ctzll(bits) >> 2 : 16;
+}
+#endif
+
+const char *textscan_line_end(const char *p, const char *end) {
+#if defined(TEXTSCAN_NEON)
+    const uint8x16_t lf = vdupq_n_u8('\n');
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    while (end - p >= 16) {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)p);
+        int i = first_set(vorrq_u8(vceqq_u8(chunk, lf), vceqq_u8(chunk, cr)));
+        if (i < 16) return p + i;
+        p += 16;
+    }
+#elif defined(TEXTSCAN_SSE2)
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int bits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, lf),
+                                                  _mm_cmpeq_epi8(chunk, cr)));
+        if (bits) return p + __builtin_ctz(bits);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '\n' && *p != '\r') p++;
+    return p;
+}
+
+const char *textscan_ascii_end(const char *p, const char *end) {
+#if defined(TEXTSCAN_NEON)
+    while (end - p >= 16) {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)p);
+        int i = first_set(vtstq_u8(chunk, vdupq_n_u8(0x80)));
+        if (i < 16) return p + i;
+        p += 16;
+    }
+#elif defined(TEXTSCAN_SSE2)
+    while (end - p >= 16) {
+        /* movemask takes the top bit of each byte, which is the test */
+        int bits = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p));
+        if (bits) return p + __builtin_ctz(bits);
+        p += 16;
+    }
+#endif
+    while (p < end && (unsigned char)*p < 0x80) p++;
+    return p;
+}
@@ -0,0 +1,17 @@
+/* Gemini Browser - Vectorized text scanning */
+#ifndef PALMINI_TEXTSCAN_H
+#define PALMINI_TEXTSCAN_H
+
+#include <stddef.h>
+
+/* The parser's inner loops, 16 bytes at a time with NEON on the device
+ * or SSE2 on an x86 host, else a byte at a time. Both return end if
+ * nothing matches, and never read at or past end. */
+
+/* First \n or \r in [p, end) */
+const char *textscan_line_end(const char *p, const char *end);
+
+/* First byte in [p, end) that is not 7-bit ASCII */
+const char *textscan_ascii_end(const char *p, const char *end);
+
+#endif /* PALMINI_TEXTSCAN_H */
@@ -1,7 +1,16 @@
 /* Gemini Browser - User interface handling */
 #define _GNU_SOURCE
 #include "ui.h"
-#include "gemini.h"
+#include "resolver.h"
+#include "connect.h"
+#include "prefetch.h"
+#include "cache.h"
+#include "disk_cache.h"
+#include "session_cache.h"
+#include "download.h"
+#include "host_stats.h"
+#include "scheduler.h"
+#include "unreachable.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,6 +47,16 @@ static void log_msg(const char *fmt, ...) {
 /* Default start page */
 #define DEFAULT_URL "gemini://geminiprotocol.net/"
 
+/* How often the downloads page updates while something is being saved */
+#define DOWNLOADS_REFRESH_MS 1000
+
+/* Pages generated by the browser itself rather than fetched */
+static bool ui_is_internal_url(const char *url) {
+    return strncmp(url, "gemini://bookmarks/", 19) == 0 ||
+           strncmp(url, "gemini://stats/", 15) == 0 ||
+           strncmp(url, "gemini://downloads/", 19) == 0;
+}
+
 UI *ui_init(void) {
     log_msg("=== Gemini Browser starting ===");
 
@@ -251,8 +270,9 @@ void ui_add_bookmark(UI *ui) {
 
     /* Add bookmark */
     strncpy(ui->bookmarks[ui->bookmark_count].url, ui->current_url.full, MAX_URL_LENGTH - 1);
-    if (ui->document && ui->document->title) {
-        strncpy(ui->bookmarks[ui->bookmark_count].title, ui->document->title, BOOKMARK_TITLE_LEN - 1);
+    const char *title = ui->document ? document_title(ui->document) : NULL;
+    if (title) {
+        strncpy(ui->bookmarks[ui->bookmark_count].title, title, BOOKMARK_TITLE_LEN - 1);
     } else {
         strncpy(ui->bookmarks[ui->bookmark_count].title, ui->current_url.full, BOOKMARK_TITLE_LEN - 1);
     }
@@ -288,6 +308,9 @@ void ui_show_bookmarks(UI *ui) {
     Document *doc = document_new();
     if (!doc) return;
 
+    /* The bookmarks page replaces whatever was loading */
+    ui_stop_loading(ui);
+
     document_add_line(doc, LINE_HEADING1, "Bookmarks", NULL);
     document_add_line(doc, LINE_TEXT, "", NULL);
 
@@ -309,6 +332,8 @@ void ui_show_bookmarks(UI *ui) {
 
     document_add_line(doc, LINE_TEXT, "", NULL);
     document_add_line(doc, LINE_LINK, "Back to browsing", return_url[0] ? return_url : DEFAULT_URL);
+    document_add_line(doc, LINE_LINK, "Downloads", "gemini://downloads/");
+    document_add_line(doc, LINE_LINK, "Browser statistics", "gemini://stats/");
 
     if (ui->document) {
         document_free(ui->document);
@@ -321,32 +346,644 @@ void ui_show_bookmarks(UI *ui) {
     ui->needs_redraw = true;
 }
 
+/* Where the time went in the last page loaded from the network */
+static char last_fetch_url[MAX_URL_LENGTH];
+static GeminiTrace last_fetch_trace;
+
+/* Percentage of part in total, 0 when total is 0 */
+static int percent(unsigned long part, unsigned long total) {
+    return total ? (int)(part * 100 / total) : 0;
+}
+
+void ui_show_stats(UI *ui) {
+    if (!ui) return;
+
+    Document *doc = document_new();
+    if (!doc) return;
+
+    ui_stop_loading(ui);
+
+    char line[256];
+    document_add_line(doc, LINE_HEADING1, "Statistics", NULL);
+    document_add_line(doc, LINE_LINK, "Latency and errors by host", "gemini://stats/hosts/");
+
+    SessionCacheStats sessions;
+    session_cache_stats(&sessions);
+    document_add_line(doc, LINE_HEADING2, "TLS sessions", NULL);
+    snprintf(line, sizeof(line), "Handshakes: %lu", sessions.handshakes);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Resumed: %lu (%d%%)", sessions.hits,
+             percent(sessions.hits, sessions.handshakes));
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Full handshakes: %lu (%lu with a session offered)",
+             sessions.misses, sessions.offered - sessions.hits);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Cached sessions: %d of %d",
+             sessions.entries, SESSION_CACHE_MAX);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+
+    ResolverStats dns;
+    resolver_stats(&dns);
+    document_add_line(doc, LINE_HEADING2, "DNS", NULL);
+    snprintf(line, sizeof(line), "Lookups: %lu", dns.lookups);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Answered from cache: %lu (%d%%)", dns.cache_hits,
+             percent(dns.cache_hits, dns.lookups));
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Joined a lookup in progress: %lu", dns.coalesced);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Failed: %lu, timed out: %lu", dns.failures, dns.timeouts);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Cached hosts: %d of %d", dns.entries, RESOLVER_CACHE_SIZE);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+
+    CacheStats cache;
+    cache_stats(&cache);
+    document_add_line(doc, LINE_HEADING2, "Page cache", NULL);
+    snprintf(line, sizeof(line), "Lookups: %lu", cache.lookups);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Hits: %lu (%d%%), %lu fresh, %lu stale",
+             cache.fresh_hits + cache.stale_hits,
+             percent(cache.fresh_hits + cache.stale_hits, cache.lookups),
+             cache.fresh_hits, cache.stale_hits);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Fetched again: %lu, %lu of them changed",
+             cache.refreshed, cache.changed);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Memory: %lu of %lu KB in %d pages (%lu evicted)",
+             (unsigned long)(cache.bytes / 1024), (unsigned long)(cache.max_bytes / 1024),
+             cache.entries, cache.evictions);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+
+    RedirectStats redirects;
+    redirect_stats(&redirects);
+    document_add_line(doc, LINE_HEADING2, "Permanent redirects", NULL);
+    snprintf(line, sizeof(line), "Remembered: %d of %d (%lu stored this session)",
+             redirects.entries, REDIRECT_MAX, redirects.remembered);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Round trips saved: %lu (%lu of them links in a page)",
+             redirects.rewrites, redirects.links);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Loops dropped: %lu", redirects.loops);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+
+    SchedulerStats sched;
+    scheduler_stats(&sched);
+    document_add_line(doc, LINE_HEADING2, "Scheduler", NULL);
+    snprintf(line, sizeof(line), "Requests: %lu, held back: %lu", sched.submitted, sched.delayed);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Slow downs: %lu, retries: %lu, given up: %lu",
+             sched.slow_downs, sched.retries, sched.given_up);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Waiting now: %d, hosts backing off: %d",
+             sched.waiting, sched.backing_off);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    for (int i = 0; i < GEMINI_PRIORITY_COUNT; i++) {
+        const SchedulerClassStats *cs = &sched.classes[i];
+        snprintf(line, sizeof(line),
+                 "%s: %d waiting, %d running; %lu started, wait avg %lu ms, max %lu ms",
+                 gemini_priority_name((GeminiPriority)i), cs->waiting, cs->running, cs->started,
+                 cs->started ? cs->wait_ms / cs->started : 0, (unsigned long)cs->max_wait_ms);
+        document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    }
+
+    DiskCacheStats disk;
+    disk_cache_stats(&disk);
+    document_add_line(doc, LINE_HEADING2, "Disk cache", NULL);
+    snprintf(line, sizeof(line), "Lookups: %lu, hits: %lu (%d%%)", disk.lookups, disk.hits,
+             percent(disk.hits, disk.lookups));
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Pages opened from disk: %lu", cache.disk_hits);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Written: %lu, evicted: %lu, damaged: %lu",
+             disk.writes, disk.evictions, disk.corrupt);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Size: %lu of %d KB in %d pages",
+             (unsigned long)(disk.bytes / 1024), DISK_CACHE_MAX_BYTES / 1024, disk.entries);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+
+    PrefetchStats pf;
+    prefetch_stats(&pf);
+    document_add_line(doc, LINE_HEADING2, "Prefetch", NULL);
+    snprintf(line, sizeof(line), "Started: %lu (%d in flight)", pf.started, pf.in_flight);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Opened from prefetch: %lu, while loading: %lu",
+             pf.served, pf.adopted);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Stored: %lu, unused: %lu, discarded: %lu",
+             pf.stored, pf.wasted, pf.discarded);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Started on touch: %lu (%lu cancelled)",
+             pf.touch_started, pf.touch_cancelled);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Skipped, host unreachable: %lu", pf.unreachable);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Held: %d pages, %lu of %d KB", pf.entries,
+             (unsigned long)(pf.bytes / 1024), PREFETCH_MAX_BYTES / 1024);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+
+    UnreachableStats dead;
+    unreachable_stats(&dead);
+    document_add_line(doc, LINE_HEADING2, "Unreachable hosts", NULL);
+    snprintf(line, sizeof(line), "Marked now: %d (%lu failures recorded)", dead.entries, dead.marked);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Attempts failed fast or skipped: %lu, retried anyway: %lu",
+             dead.hits, dead.overrides);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+
+    ConnectStats conns;
+    connect_stats(&conns);
+    document_add_line(doc, LINE_HEADING2, "Connections", NULL);
+    snprintf(line, sizeof(line), "Connects: %lu (%lu failed)", conns.races, conns.failed);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "First address won: %lu (%d%%)", conns.won_first,
+             percent(conns.won_first, conns.races - conns.failed));
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Fallback address won: %lu", conns.won_fallback);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "IPv6: %lu, IPv4: %lu", conns.ipv6_wins, conns.ipv4_wins);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    if (conns.fast_open_unsupported) {
+        snprintf(line, sizeof(line), "TCP Fast Open: not supported by this system");
+    }
+    else {
+        snprintf(line, sizeof(line),
+                 "TCP Fast Open: %s (%lu connections, %lu with data in the SYN)",
+                 gemini_fast_open() ? "on" : "off", conns.fast_open_tries,
+                 conns.fast_open_deferred);
+    }
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    if (!conns.fast_open_unsupported) {
+        document_add_line(doc, LINE_LINK,
+                          gemini_fast_open() ? "Turn TCP Fast Open off" : "Turn TCP Fast Open on",
+                          gemini_fast_open() ? "gemini://stats/fastopen/off"
+                                             : "gemini://stats/fastopen/on");
+    }
+
+    GeminiRecvStats recv;
+    GeminiEngineStats engine;
+    gemini_recv_stats(&recv);
+    gemini_engine_stats(&engine);
+    document_add_line(doc, LINE_HEADING2, "Downloads", NULL);
+    snprintf(line, sizeof(line), "Requests: %lu (%d in flight, at most %d at once)",
+             engine.started, engine.active, engine.peak_active);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Paused for a navigation: %lu", engine.pauses);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Fetches: %lu, %lu KB received", recv.fetches,
+             (unsigned long)(recv.received / 1024));
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Moved while growing: %lu KB in %lu reallocations",
+             (unsigned long)(recv.moved / 1024), recv.grows);
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+    snprintf(line, sizeof(line), "Largest buffer: %lu KB",
+             (unsigned long)(recv.peak_buffer / 1024));
+    document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+
+    if (last_fetch_url[0]) {
+        const GeminiTrace *trace = &last_fetch_trace;
+        document_add_line(doc, LINE_HEADING2, "Last page load", NULL);
+        document_add_line(doc, LINE_LINK, last_fetch_url, last_fetch_url);
+        for (int phase = 0; phase < GEMINI_PHASE_COUNT; phase++) {
+            long ms = gemini_phase_ms(trace, (GeminiPhase)phase);
+            if (ms < 0) {
+                snprintf(line, sizeof(line), "%s: -", gemini_phase_name((GeminiPhase)phase));
+            }
+            else {
+                snprintf(line, sizeof(line), "%s: %ld ms", gemini_phase_name((GeminiPhase)phase), ms);
+            }
+            document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+        }
+        snprintf(line, sizeof(line), "Received: %lu bytes", (unsigned long)trace->received);
+        document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+        if (trace->tls_version[0]) {
+            snprintf(line, sizeof(line), "%s, %s, %s", trace->tls_version, trace->tls_cipher,
+                     trace->tls_resumed ? "session resumed" : "full handshake");
+            document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+        }
+    }
+
+    if (ui->document) {
+        document_free(ui->document);
+    }
+    ui->document = doc;
+    ui->scroll_y = 0;
+
+    url_parse("gemini://stats/", &ui->current_url);
+    ui->needs_redraw = true;
+}
+
+/* "512 bytes", "48 KB", "3.2 MB" */
+static void format_size(char *buf, size_t len, size_t bytes) {
+    if (bytes < 1024) {
+        snprintf(buf, len, "%lu bytes", (unsigned long)bytes);
+    }
+    else if (bytes < 1024 * 1024) {
+        snprintf(buf, len, "%lu KB", (unsigned long)(bytes / 1024));
+    }
+    else {
+        snprintf(buf, len, "%.1f MB", bytes / (1024.0 * 1024.0));
+    }
+}
+
+void ui_show_downloads(UI *ui) {
+    if (!ui) return;
+
+    /* Save return URL (only if not already on the downloads page) */
+    static char return_url[MAX_URL_LENGTH] = {0};
+    bool refresh = strncmp(ui->current_url.full, "gemini://downloads", 18) == 0;
+    if (!refresh && !ui_is_internal_url(ui->current_url.full)) {
+        strncpy(return_url, ui->current_url.full, MAX_URL_LENGTH - 1);
+    }
+
+    Document *doc = document_new();
+    if (!doc) return;
+
+    char line[512];
+    char size[32];
+    document_add_line(doc, LINE_HEADING1, "Downloads", NULL);
+    snprintf(line, sizeof(line), "Files that can't be shown are saved in %s", DOWNLOAD_DIR);
+    document_add_line(doc, LINE_TEXT, line, NULL);
+
+    bool any = false;
+    for (int i = 0; i < DOWNLOAD_MAX; i++) {
+        DownloadInfo info;
+        if (!download_get(i, &info)) continue;
+        any = true;
+
+        const char *name = strrchr(info.path, '/');
+        document_add_line(doc, LINE_HEADING3, name ? name + 1 : info.path, NULL);
+        document_add_line(doc, LINE_LINK, info.url, info.url);
+
+        format_size(size, sizeof(size), info.bytes);
+        unsigned long rate = info.elapsed_ms ?
+            (unsigned long)((double)info.bytes * 1000 / info.elapsed_ms / 1024) : 0;
+        switch (info.state) {
+            case DOWNLOAD_RUNNING:
+                snprintf(line, sizeof(line), "Saving: %s so far, %lu KB/s", size, rate);
+                break;
+            case DOWNLOAD_DONE:
+                snprintf(line, sizeof(line), "Saved: %s in %lu s, %lu KB/s", size,
+                         (unsigned long)(info.elapsed_ms / 1000), rate);
+                break;
+            default:
+                snprintf(line, sizeof(line), "Failed after %s: %s", size, info.error);
+                break;
+        }
+        document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+        if (info.mime[0]) {
+            snprintf(line, sizeof(line), "Type: %s", info.mime);
+            document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+        }
+
+        if (info.state == DOWNLOAD_RUNNING) {
+            char cancel_url[40];
+            snprintf(cancel_url, sizeof(cancel_url), "gemini://downloads/cancel/%d", i);
+            document_add_line(doc, LINE_LINK, "  [cancel]", cancel_url);
+        }
+    }
+    if (!any) {
+        document_add_line(doc, LINE_TEXT, "", NULL);
+        document_add_line(doc, LINE_TEXT, "Nothing downloaded yet.", NULL);
+    }
+
+    document_add_line(doc, LINE_TEXT, "", NULL);
+    document_add_line(doc, LINE_LINK, "Back to browsing", return_url[0] ? return_url : DEFAULT_URL);
+
+    /* Progress updates keep the reader's place */
+    if (!refresh) {
+        ui_stop_loading(ui);
+        ui->scroll_y = 0;
+    }
+    if (ui->document) {
+        document_free(ui->document);
+    }
+    ui->document = doc;
+    ui->downloads_shown = SDL_GetTicks();
+
+    url_parse("gemini://downloads/", &ui->current_url);
+    ui->needs_redraw = true;
+}
+
+/* "<16 ms" for a histogram bucket */
+static void format_bucket(char *buf, size_t len, int bucket) {
+    long limit = host_stats_bucket_limit(bucket);
+    if (limit < 0) {
+        snprintf(buf, len, ">%ld s", host_stats_bucket_limit(bucket - 1) / 1000);
+    }
+    else {
+        snprintf(buf, len, "<%ld ms", limit);
+    }
+}
+
+void ui_show_host_stats(UI *ui) {
+    if (!ui) return;
+
+    HostStats *hosts = malloc(HOST_STATS_MAX * sizeof(HostStats));
+    Document *doc = document_new();
+    if (!hosts || !doc) {
+        free(hosts);
+        if (doc) document_free(doc);
+        return;
+    }
+
+    ui_stop_loading(ui);
+
+    char line[512];
+    document_add_line(doc, LINE_HEADING1, "Hosts", NULL);
+    document_add_line(doc, LINE_TEXT,
+                      "Percentiles are upper bounds of power-of-two buckets, "
+                      "over every request since the statistics were started.", NULL);
+
+    int n = host_stats_snapshot(hosts, HOST_STATS_MAX);
+    if (n == 0) {
+        document_add_line(doc, LINE_TEXT, "", NULL);
+        document_add_line(doc, LINE_TEXT, "Nothing recorded yet.", NULL);
+    }
+    for (int i = 0; i < n; i++) {
+        const HostStats *h = &hosts[i];
+        document_add_line(doc, LINE_HEADING2, h->host, NULL);
+
+        /* Requests, then each result that occurred */
+        int len = snprintf(line, sizeof(line), "Requests: %lu",
+                           (unsigned long)host_stats_total(h->results, HOST_RESULT_COUNT));
+        const char *sep = " (";
+        for (int r = 0; r < HOST_RESULT_COUNT && len < (int)sizeof(line); r++) {
+            if (!h->results[r]) continue;
+            len += snprintf(line + len, sizeof(line) - len, "%s%s: %lu", sep,
+                            host_stats_result_name((HostResult)r), (unsigned long)h->results[r]);
+            sep = ", ";
+        }
+        if (sep[0] == ',' && len < (int)sizeof(line)) {
+            snprintf(line + len, sizeof(line) - len, ")");
+        }
+        document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+
+        for (int m = 0; m < HOST_METRIC_COUNT; m++) {
+            const uint32_t *histogram = h->histograms[m];
+            uint32_t samples = host_stats_total(histogram, HOST_STATS_BUCKETS);
+            if (!samples) continue;
+
+            char p50[16], p95[16], p99[16];
+            format_bucket(p50, sizeof(p50), host_stats_percentile(histogram, 50));
+            format_bucket(p95, sizeof(p95), host_stats_percentile(histogram, 95));
+            format_bucket(p99, sizeof(p99), host_stats_percentile(histogram, 99));
+            snprintf(line, sizeof(line), "%s: p50 %s, p95 %s, p99 %s (%lu)",
+                     host_stats_metric_name((HostMetric)m), p50, p95, p99,
+                     (unsigned long)samples);
+            document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+        }
+
+        if (host_stats_total(h->fast_open, HOST_FAST_OPEN_COUNT)) {
+            len = snprintf(line, sizeof(line), "TCP Fast Open:");
+            sep = " ";
+            for (int o = 0; o < HOST_FAST_OPEN_COUNT && len < (int)sizeof(line); o++) {
+                if (!h->fast_open[o]) continue;
+                len += snprintf(line + len, sizeof(line) - len, "%s%s %lu", sep,
+                                host_stats_fast_open_name((HostFastOpen)o),
+                                (unsigned long)h->fast_open[o]);
+                sep = ", ";
+            }
+            document_add_line(doc, LINE_LIST_ITEM, line, NULL);
+        }
+    }
+    free(hosts);
+
+    document_add_line(doc, LINE_TEXT, "", NULL);
+    document_add_line(doc, LINE_LINK, "Back to statistics", "gemini://stats/");
+
+    if (ui->document) {
+        document_free(ui->document);
+    }
+    ui->document = doc;
+    ui->scroll_y = 0;
+
+    url_parse("gemini://stats/hosts/", &ui->current_url);
+    ui->needs_redraw = true;
+}
+
+static void ui_show_response(UI *ui, const Url *fetched_url, const GeminiResponse *resp);
+
+/* userdata of requests that revalidate a stale page already on screen */
+static int ui_refresh_tag;
+
+/* Whether a page of this MIME type can be shown rather than saved */
+static bool ui_can_display(const char *mime) {
+    /* Empty meta defaults to text/gemini */
+    return mime[0] == '\0' || strncmp(mime, "text/", 5) == 0;
+}
+
+/* Resolve the links of a page fetched from base once, up front, and
+ * point links to pages that moved permanently straight at their new
+ * home, so neither a tap nor a prefetch pays for the extra round trip */
+static void ui_prepare_links(Document *doc, const Url *base) {
+    if (!doc) return;
+    document_resolve_links(doc, base);
+
+    RedirectStats redirects;
+    redirect_stats(&redirects);
+    if (redirects.entries == 0) return;
+
+    for (size_t i = 0; i < document_link_count(doc); i++) {
+        const char *resolved = document_link_resolved(doc, i);
+        Url link, moved;
+        if (!resolved || !url_parse(resolved, &link) || !url_is_gemini(&link) ||
+            !redirect_apply_link(&link, &moved)) continue;
+
+        document_set_link_resolved(doc, i, moved.full);
+    }
+}
+
+/* Build the document for a successful response */
+static Document *ui_build_document(const GeminiResponse *resp) {
+    Document *doc;
+
+    /* Check MIME type */
+    const char *mime = resp->meta;
+    if (strncmp(mime, "text/gemini", 11) == 0 || mime[0] == '\0') {
+        doc = document_parse(resp->body, resp->body_len);
+    }
+    else if (strncmp(mime, "text/", 5) == 0) {
+        /* Plain text - wrap in simple document */
+        doc = document_new();
+        if (doc && resp->body) {
+            document_add_line(doc, LINE_PREFORMATTED, resp->body, NULL);
+        }
+    }
+    else {
+        /* Unsupported MIME type */
+        doc = document_new();
+        if (doc) {
+            char msg[256];
+            snprintf(msg, sizeof(msg), "Cannot display: %s", mime);
+            document_add_line(doc, LINE_TEXT, msg, NULL);
+        }
+    }
+    return doc;
+}
+
+/* Check one redirect hop of a navigation away from url against the chain
+ * followed so far. Returns false, with the status line saying why, when
+ * it mustn't be followed; otherwise records the hop and sets *target. */
+static bool ui_follow_redirect(UI *ui, const Url *url, const GeminiResponse *resp, Url *target) {
+    /* Resolve against the URL that was actually fetched */
+    char redirect_url[sizeof(resp->meta)];
+    strncpy(redirect_url, resp->meta, sizeof(redirect_url));
+    bool valid = url_resolve(url, redirect_url, target);
+
+    if (!valid || !url_is_gemini(target)) {
+        ui->redirect_count = 0;
+        snprintf(ui->status_message, sizeof(ui->status_message),
+                 "Unsupported redirect: %s", redirect_url);
+        ui->needs_redraw = true;
+        return false;
+    }
+
+    /* Each response is one hop of the chain - stop at a URL it has
+     * already passed through, or once it gets too long */
+    bool loop = strcmp(target->full, url->full) == 0;
+    for (int i = 0; i < ui->redirect_count && !loop; i++) {
+        loop = strcmp(ui->redirect_chain[i], target->full) == 0;
+    }
+    if (loop || ui->redirect_count >= REDIRECT_MAX_CHAIN) {
+        /* A remembered hop may be what closes the loop */
+        redirect_forget(url);
+        for (int i = 0; i < ui->redirect_count; i++) {
+            Url hop;
+            if (url_parse(ui->redirect_chain[i], &hop)) redirect_forget(&hop);
+        }
+        ui->redirect_count = 0;
+        snprintf(ui->status_message, sizeof(ui->status_message),
+                 loop ? "Redirect loop" : "Too many redirects");
+        ui->needs_redraw = true;
+        return false;
+    }
+    strncpy(ui->redirect_chain[ui->redirect_count], url->full, MAX_URL_LENGTH - 1);
+    ui->redirect_count++;
+
+    /* Next time, go straight to the target */
+    if (resp->status == GM_STATUS_REDIRECT_PERM) {
+        redirect_remember(url, target);
+    }
+    return true;
+}
+
+/* Start fetching url in the background. The current page stays visible and
+ * scrollable until ui_fetch_done() receives the response. Redirects the
+ * prefetch store or cache can answer are followed here, one hop per pass,
+ * until a hop needs the network. */
+static void ui_begin_fetch(UI *ui, const Url *url, bool is_back, int scroll) {
+    /* A new navigation supersedes whatever was loading */
+    ui_stop_loading(ui);
+
+    ui->pending_is_back = is_back;
+    ui->pending_scroll = scroll;
+
+    Url hop;
+    memcpy(&hop, url, sizeof(Url));
+    for (;;) {
+        /* A page that moved permanently is fetched from its new home */
+        Url moved;
+        if (redirect_apply(&hop, &moved)) memcpy(&hop, &moved, sizeof(Url));
+
+        /* A prefetched page is the newest copy there is, then the cache */
+        CacheLookup cached = CACHE_MISS;
+        GeminiResponse *resp = prefetch_take(&hop);
+        if (resp) {
+            cache_put(&hop, resp);
+        }
+        else {
+            cached = cache_get(&hop, &resp);
+        }
+
+        /* Anything not fresh needs the network - take over a prefetch of it
+         * that is still loading */
+        GeminiRequest *req = NULL;
+        if (!resp || cached == CACHE_STALE) {
+            req = prefetch_adopt(&hop);
+        }
+
+        /* The next page has other links - free the network for this one */
+        prefetch_cancel_all();
+
+        if (!resp) {
+            /* The user is waiting for it now */
+            if (req) gemini_fetch_promote(req, GEMINI_PRIORITY_INTERACTIVE);
+            ui->pending = req;
+            if (!ui->pending) {
+                ui->pending = gemini_fetch_async(&hop, GEMINI_FETCH_TEXT_ONLY, NULL);
+            }
+            if (!ui->pending) {
+                snprintf(ui->status_message, sizeof(ui->status_message), "Request failed");
+                ui->needs_redraw = true;
+                return;
+            }
+
+            ui->loading = true;
+            snprintf(ui->status_message, sizeof(ui->status_message), "Loading %s...", hop.host);
+            ui->needs_redraw = true;
+            return;
+        }
+
+        if (cached == CACHE_STALE) {
+            /* Stale-while-revalidate: ui_refresh_done() swaps in the new
+             * copy if it differs */
+            if (req) {
+                gemini_fetch_promote(req, GEMINI_PRIORITY_REVALIDATE);
+            }
+            else {
+                GeminiRequestOptions opts;
+                memset(&opts, 0, sizeof(opts));
+                opts.flags = GEMINI_FETCH_TEXT_ONLY;
+                opts.priority = GEMINI_PRIORITY_REVALIDATE;
+                req = gemini_fetch_async_ex(&hop, &opts);
+            }
+            if (req) req->userdata = &ui_refresh_tag;
+        }
+
+        if (gemini_status_category(resp->status) != 3) {
+            ui_show_response(ui, &hop, resp);
+            gemini_response_free(resp);
+            return;
+        }
+
+        Url target;
+        bool follow = ui_follow_redirect(ui, &hop, resp, &target);
+        gemini_response_free(resp);
+        if (!follow) return;
+        memcpy(&hop, &target, sizeof(Url));
+    }
+}
+
+void ui_stop_loading(UI *ui) {
+    if (!ui || !ui->pending) return;
+
+    /* The request is freed when it completes */
+    gemini_fetch_cancel(ui->pending);
+    ui->pending = NULL;
+    ui->loading = false;
+    ui->status_message[0] = '\0';
+    ui->needs_redraw = true;
+}
+
 static void ui_go_back(UI *ui) {
     if (!ui || !history_can_back(&ui->history)) return;
 
+    ui->outline_open = false;
+
     Url url;
     int scroll;
     if (history_back(&ui->history, &url, &scroll)) {
-        ui->loading = true;
-        ui_draw(ui);
-
-        GeminiResponse *resp = gemini_fetch(&url);
-        ui->loading = false;
-
-        if (resp && gemini_status_category(resp->status) == 2) {
-            if (ui->document) document_free(ui->document);
-            ui->document = document_parse(resp->body, resp->body_len);
-            memcpy(&ui->current_url, &url, sizeof(Url));
-            ui->scroll_y = scroll;
-        }
-        gemini_response_free(resp);
-        ui->needs_redraw = true;
+        ui->redirect_count = 0;
+        ui_begin_fetch(ui, &url, true, scroll);
     }
 }
 
 void ui_navigate(UI *ui, const char *url_str) {
     if (!ui || !url_str) return;
 
+    ui->outline_open = false;
+
     /* Handle special bookmark URLs */
     if (strcmp(url_str, "gemini://bookmarks/") == 0) {
         ui_show_bookmarks(ui);
@@ -358,6 +995,29 @@ void ui_navigate(UI *ui, const char *url_str) {
         ui_show_bookmarks(ui);  /* Refresh the bookmarks page */
         return;
     }
+    if (strcmp(url_str, "gemini://stats/") == 0) {
+        ui_show_stats(ui);
+        return;
+    }
+    if (strcmp(url_str, "gemini://stats/fastopen/on") == 0 ||
+        strcmp(url_str, "gemini://stats/fastopen/off") == 0) {
+        gemini_set_fast_open(strcmp(url_str + 24, "on") == 0);
+        ui_show_stats(ui);
+        return;
+    }
+    if (strcmp(url_str, "gemini://stats/hosts/") == 0) {
+        ui_show_host_stats(ui);
+        return;
+    }
+    if (strcmp(url_str, "gemini://downloads/") == 0) {
+        ui_show_downloads(ui);
+        return;
+    }
+    if (strncmp(url_str, "gemini://downloads/cancel/", 26) == 0) {
+        download_cancel(atoi(url_str + 26));
+        ui_show_downloads(ui);
+        return;
+    }
 
     Url url;
 
@@ -386,46 +1046,47 @@ void ui_navigate(UI *ui, const char *url_str) {
         return;
     }
 
+    /* Opening a page on a host that just failed fast means: try it anyway */
+    if (ui->unreachable.port == url.port && strcmp(ui->unreachable.host, url.host) == 0) {
+        unreachable_override(url.host, url.port);
+    }
+    memset(&ui->unreachable, 0, sizeof(ui->unreachable));
+
     /* Save scroll position for current page */
     history_update_scroll(&ui->history, ui->scroll_y);
 
-    /* Show loading state */
-    ui->loading = true;
-    snprintf(ui->status_message, sizeof(ui->status_message), "Loading %s...", url.host);
-    ui_draw(ui);
+    ui->redirect_count = 0;
+    ui_begin_fetch(ui, &url, false, 0);
+}
 
-    /* Fetch the page */
-    GeminiResponse *resp = gemini_fetch(&url);
+/* Display the response to a navigation of fetched_url: follow redirects,
+ * show errors or parse the page. resp stays owned by the caller. */
+static void ui_show_response(UI *ui, const Url *fetched_url, const GeminiResponse *resp) {
+    Url url;
+    memcpy(&url, fetched_url, sizeof(Url));
 
-    ui->loading = false;
+    int category = gemini_status_category(resp->status);
 
-    if (!resp) {
-        snprintf(ui->status_message, sizeof(ui->status_message), "Request failed");
-        ui->needs_redraw = true;
+    if (category == 3) {
+        Url target;
+        if (ui_follow_redirect(ui, &url, resp, &target)) {
+            ui_begin_fetch(ui, &target, ui->pending_is_back, ui->pending_scroll);
+        }
         return;
     }
 
-    int category = gemini_status_category(resp->status);
-
-    if (category == 3) {
-        /* Redirect */
-        char *redirect_url = strdup(resp->meta);
-        gemini_response_free(resp);
+    ui->redirect_count = 0;
 
-        /* Limit redirect depth */
-        static int redirect_count = 0;
-        redirect_count++;
-        if (redirect_count > 5) {
-            redirect_count = 0;
-            snprintf(ui->status_message, sizeof(ui->status_message), "Too many redirects");
+    if (category == 2 && !ui_can_display(resp->meta)) {
+        /* The navigation fetch stopped at the header - fetch the file
+         * again straight to disk and show its progress */
+        if (download_start(&url, resp->meta) < 0) {
+            snprintf(ui->status_message, sizeof(ui->status_message),
+                     "Cannot save %s", url.full);
             ui->needs_redraw = true;
-            free(redirect_url);
             return;
         }
-
-        ui_navigate(ui, redirect_url);
-        redirect_count = 0;
-        free(redirect_url);
+        ui_show_downloads(ui);
         return;
     }
 
@@ -439,13 +1100,14 @@ void ui_navigate(UI *ui, const char *url_str) {
         snprintf(ui->status_message, sizeof(ui->status_message),
                  "%s: %s", gemini_status_string(resp->status),
                  resp->error_msg[0] ? resp->error_msg : resp->meta);
+        if (resp->status == GM_STATUS_ERROR_UNREACHABLE) {
+            memcpy(&ui->unreachable, &url, sizeof(Url));
+        }
 
         render_error(ui->renderer, gemini_status_string(resp->status),
                     resp->error_msg[0] ? resp->error_msg : resp->meta);
         render_address_bar(ui->renderer, url.full, false, false, history_can_back(&ui->history));
         render_flip(ui->renderer);
-
-        gemini_response_free(resp);
         return;
     }
 
@@ -453,37 +1115,176 @@ void ui_navigate(UI *ui, const char *url_str) {
     if (ui->document) {
         document_free(ui->document);
     }
+    ui->document = ui_build_document(resp);
+    ui_prepare_links(ui->document, &url);
 
-    /* Check MIME type */
-    const char *mime = resp->meta;
-    if (strncmp(mime, "text/gemini", 11) == 0 || mime[0] == '\0') {
-        ui->document = document_parse(resp->body, resp->body_len);
+    /* Update state */
+    memcpy(&ui->current_url, &url, sizeof(Url));
+    if (ui->pending_is_back) {
+        ui->scroll_y = ui->pending_scroll;
     }
-    else if (strncmp(mime, "text/", 5) == 0) {
-        /* Plain text - wrap in simple document */
-        ui->document = document_new();
-        if (ui->document && resp->body) {
-            document_add_line(ui->document, LINE_PREFORMATTED, resp->body, NULL);
+    else {
+        history_push(&ui->history, &url, 0);
+        ui->scroll_y = 0;
+    }
+    ui->scroll_velocity = 0;
+    ui->status_message[0] = '\0';
+    ui->needs_redraw = true;
+}
+
+/* A revalidation of a stale cached page finished */
+static void ui_refresh_done(UI *ui, GeminiRequest *req) {
+    GeminiResponse *resp = req->response;
+
+    /* Redraw only if the reader is still on the page and it changed */
+    if (resp && cache_put(&req->url, resp) && !ui->pending &&
+        strcmp(ui->current_url.full, req->url.full) == 0) {
+        Document *doc = ui_build_document(resp);
+        if (doc) {
+            ui_prepare_links(doc, &req->url);
+            if (ui->document) document_free(ui->document);
+            ui->document = doc;
+            ui->needs_redraw = true;
         }
     }
+
+    gemini_request_free(req);
+}
+
+/* Handle a request taken from the completion queue */
+static void ui_fetch_done(UI *ui, GeminiRequest *req) {
+    if (req != ui->pending) {
+        if (req->userdata == &ui_refresh_tag) {
+            ui_refresh_done(ui, req);
+            return;
+        }
+        if (prefetch_done(req)) {
+            /* A slot opened up for the next visible link */
+            ui->prefetch_dirty = true;
+            return;
+        }
+        if (download_done(req)) {
+            if (strcmp(ui->current_url.full, "gemini://downloads/") == 0) {
+                ui_show_downloads(ui);
+            }
+            return;
+        }
+
+        /* Cancelled or superseded - nobody is waiting for it */
+        gemini_request_free(req);
+        return;
+    }
+
+    ui->pending = NULL;
+    ui->loading = false;
+
+    if (req->response) {
+        strncpy(last_fetch_url, req->url.full, sizeof(last_fetch_url) - 1);
+        last_fetch_trace = req->response->trace;
+    }
+
+    if (!req->response) {
+        gemini_request_free(req);
+        snprintf(ui->status_message, sizeof(ui->status_message), "Request failed");
+        ui->needs_redraw = true;
+        return;
+    }
+
+    if (req->response->truncated && (req->flags & GEMINI_FETCH_SMALL)) {
+        /* An adopted prefetch stopped at its size cap - fetch the whole page */
+        Url url;
+        memcpy(&url, &req->url, sizeof(Url));
+        gemini_request_free(req);
+        ui_begin_fetch(ui, &url, ui->pending_is_back, ui->pending_scroll);
+        return;
+    }
+
+    ui_show_response(ui, &req->url, req->response);
+    cache_put(&req->url, req->response);
+    gemini_request_free(req);
+}
+
+/* Where the link on document line index goes: resolved when the page
+ * was shown if it came from the network, else as written. NULL if the
+ * line is not a link. */
+static const char *ui_link_target(UI *ui, int index) {
+    if (!ui->document || index < 0 || index >= (int)ui->document->num_lines) return NULL;
+
+    const DocLine *line = &ui->document->lines[index];
+    if (line->type != LINE_LINK) return NULL;
+    const char *resolved = document_link_resolved(ui->document, line->link);
+    return resolved ? resolved : document_line_url(ui->document, line);
+}
+
+/* Resolve the link on document line index against the current page.
+ * Returns false unless it is a link to a page on the network. */
+static bool ui_resolve_link(UI *ui, int index, Url *out) {
+    const char *link_url = ui_link_target(ui, index);
+    if (!link_url || ui_is_internal_url(link_url)) return false;
+
+    bool valid;
+    if (ui->current_url.host[0] && !strstr(link_url, "://")) {
+        valid = url_resolve(&ui->current_url, link_url, out);
+    }
     else {
-        /* Unsupported MIME type */
-        ui->document = document_new();
-        if (ui->document) {
-            char msg[256];
-            snprintf(msg, sizeof(msg), "Cannot display: %s", mime);
-            document_add_line(ui->document, LINE_TEXT, msg, NULL);
+        valid = url_parse(link_url, out);
+    }
+    return valid && url_is_gemini(out) && !ui_is_internal_url(out->full);
+}
+
+/* Prefetch the gemini:// links on screen, in reading order */
+static void ui_prefetch_visible(UI *ui) {
+    Renderer *r = ui->renderer;
+    int last_index = -1;
+
+    ui->prefetch_dirty = false;
+
+    for (size_t i = 0; i < r->num_rendered; i++) {
+        const RenderedLine *rl = &r->rendered_lines[i];
+
+        /* Wrapped links have one entry per screen line */
+        if (!rl->is_link || rl->doc_line_index == last_index) continue;
+        if (rl->bounds.y + rl->bounds.h <= MARGIN_TOP || rl->bounds.y >= ui->screen_height) continue;
+        last_index = rl->doc_line_index;
+
+        Url url;
+        if (!ui_resolve_link(ui, last_index, &url)) continue;
+        if (strcmp(url.full, ui->current_url.full) == 0) continue;
+        if (cache_peek(&url) == CACHE_FRESH) continue;
+
+        if (prefetch_start(&url) == PREFETCH_FULL) {
+            /* Picked up again when a slot frees */
+            break;
         }
     }
+}
 
-    gemini_response_free(resp);
+/* Heading of the section at the top of the screen, or -1 */
+static int ui_current_heading(UI *ui) {
+    return document_heading_before(ui->document, ui->scroll_y + 1);
+}
 
-    /* Update state */
-    memcpy(&ui->current_url, &url, sizeof(Url));
-    history_push(&ui->history, &url, 0);
-    ui->scroll_y = 0;
+/* Show or hide the outline of the page, opened on the current section */
+static void ui_toggle_outline(UI *ui) {
+    if (ui->outline_open || !ui->document || ui->document->num_headings == 0) {
+        ui->outline_open = false;
+    }
+    else {
+        render_layout(ui->renderer, ui->document);
+        ui->outline_open = true;
+        ui->outline_scroll = render_outline_scroll_to(ui->renderer, ui->document,
+                                                      ui_current_heading(ui));
+    }
+    ui->needs_redraw = true;
+}
+
+/* Scroll straight to a heading. Its offset is known from the layout, so
+ * nothing above it is measured again. */
+static void ui_jump_to_heading(UI *ui, int index) {
+    ui->scroll_y = ui->document->headings[index].y;
+    if (ui->max_scroll < ui->scroll_y) ui->max_scroll = ui->scroll_y;
     ui->scroll_velocity = 0;
-    ui->status_message[0] = '\0';
+    ui->outline_open = false;
     ui->needs_redraw = true;
 }
 
@@ -501,10 +1302,17 @@ bool ui_handle_event(UI *ui, SDL_Event *event) {
                 if (!ui->paused) {
                     ui->needs_redraw = true;
                 }
+                else {
+                    /* webOS may kill a backgrounded app without warning */
+                    gemini_persist();
+                    redirect_save();
+                    disk_cache_sync();
+                }
             }
             break;
 
         case SDL_MOUSEBUTTONDOWN:
+            ui->last_input = SDL_GetTicks();
             ui->touch_active = true;
             ui->touch_start_x = event->button.x;
             ui->touch_start_y = event->button.y;
@@ -512,19 +1320,40 @@ bool ui_handle_event(UI *ui, SDL_Event *event) {
             ui->touch_start_time = SDL_GetTicks();
             ui->is_dragging = false;
             ui->scroll_velocity = 0;
+
+            /* Start loading the link under the finger now; the tap is only
+             * recognised on release, up to TAP_TIME_THRESHOLD later */
+            if (event->button.y >= MARGIN_TOP && !ui->address_focused && !ui->outline_open &&
+                ui->document) {
+                Url url;
+                int link_idx = render_hit_test(ui->renderer, event->button.x, event->button.y);
+                if (link_idx >= 0 && ui_resolve_link(ui, link_idx, &url) &&
+                    cache_peek(&url) != CACHE_FRESH) {
+                    prefetch_touch(&url);
+                }
+            }
             break;
 
         case SDL_MOUSEMOTION:
             if (ui->touch_active) {
+                ui->last_input = SDL_GetTicks();
                 int dy = event->motion.y - ui->touch_last_y;
                 int total_dx = abs(event->motion.x - ui->touch_start_x);
                 int total_dy = abs(event->motion.y - ui->touch_start_y);
 
-                if (total_dx > TAP_THRESHOLD || total_dy > TAP_THRESHOLD) {
+                if (!ui->is_dragging && (total_dx > TAP_THRESHOLD || total_dy > TAP_THRESHOLD)) {
                     ui->is_dragging = true;
+                    prefetch_touch_cancel();
                 }
 
-                if (ui->is_dragging && !ui->address_focused) {
+                if (ui->is_dragging && ui->outline_open) {
+                    int max = render_outline_max_scroll(ui->renderer, ui->document);
+                    ui->outline_scroll -= dy;
+                    if (ui->outline_scroll > max) ui->outline_scroll = max;
+                    if (ui->outline_scroll < 0) ui->outline_scroll = 0;
+                    ui->needs_redraw = true;
+                }
+                else if (ui->is_dragging && !ui->address_focused) {
                     ui->scroll_y -= dy;
 
                     /* Clamp scroll */
@@ -558,12 +1387,17 @@ bool ui_handle_event(UI *ui, SDL_Event *event) {
                             render_button_highlight(ui->renderer, btn);
                             ui->needs_redraw = true;
                         }
-                        if (btn == 1) {
+                        if (btn == 1 && ui->loading) {
+                            /* Back doubles as stop while a page loads */
+                            ui_stop_loading(ui);
+                        } else if (btn == 1) {
                             ui_go_back(ui);
                         } else if (btn == 2) {
                             ui_add_bookmark(ui);
                         } else if (btn == 3) {
                             ui_show_bookmarks(ui);
+                        } else if (btn == 4) {
+                            ui_toggle_outline(ui);
                         } else {
                             ui_focus_address(ui);
                         }
@@ -572,28 +1406,48 @@ bool ui_handle_event(UI *ui, SDL_Event *event) {
                         /* Tapped outside address bar - unfocus */
                         ui_unfocus_address(ui);
                     }
+                    else if (ui->outline_open) {
+                        /* Jump to the heading tapped, or just close */
+                        int heading = render_outline_hit_test(ui->renderer, ui->document,
+                                                              ui->outline_scroll, x, y);
+                        if (heading >= 0) {
+                            ui_jump_to_heading(ui, heading);
+                        }
+                        else {
+                            ui_toggle_outline(ui);
+                        }
+                    }
                     else if (ui->document) {
                         /* Check for link tap */
                         int link_idx = render_hit_test(ui->renderer, x, y);
-                        if (link_idx >= 0 && link_idx < (int)ui->document->num_lines) {
-                            const char *link_url = ui->document->lines[link_idx].url;
-                            if (link_url) {
-                                ui_navigate(ui, link_url);
-                            }
+                        const char *link_url = ui_link_target(ui, link_idx);
+                        if (link_url) {
+                            ui_navigate(ui, link_url);
                         }
                     }
                 }
 
+                /* A tap on the link has adopted its touch-down fetch by now.
+                 * Anything else (drag, long press, missed link) cancels it. */
+                prefetch_touch_cancel();
+
                 ui->touch_active = false;
             }
             break;
 
         case SDL_KEYDOWN:
+            ui->last_input = SDL_GetTicks();
             switch (event->key.keysym.sym) {
                 case SDLK_ESCAPE:  /* Same as PDLK_GESTURE_BACK (27) */
                     if (ui->address_focused) {
                         ui_unfocus_address(ui);
                     }
+                    else if (ui->outline_open) {
+                        ui_toggle_outline(ui);
+                    }
+                    else if (ui->loading) {
+                        ui_stop_loading(ui);
+                    }
                     else if (history_can_back(&ui->history)) {
                         ui_go_back(ui);
                     }
@@ -651,6 +1505,15 @@ bool ui_handle_event(UI *ui, SDL_Event *event) {
         case SDL_VIDEOEXPOSE:
             ui->needs_redraw = true;
             break;
+
+        case SDL_USEREVENT:
+            if (event->user.code == GEMINI_EVENT_FETCH_DONE) {
+                GeminiRequest *req;
+                while ((req = gemini_take_completed()) != NULL) {
+                    ui_fetch_done(ui, req);
+                }
+            }
+            break;
     }
 
     return ui->running;
@@ -681,23 +1544,48 @@ void ui_update(UI *ui, Uint32 dt) {
     else if (!ui->touch_active) {
         ui->scroll_velocity = 0;
     }
+
+    /* Fetch what the user is likely to tap next once they stop moving */
+    if (ui->prefetch_dirty && ui->document && !ui->loading && !ui->touch_active &&
+        !ui->address_focused && ui->scroll_velocity == 0 &&
+        SDL_GetTicks() - ui->last_input >= PREFETCH_IDLE_MS) {
+        ui_prefetch_visible(ui);
+    }
+
+    /* Keep download progress current while it is on screen */
+    if (download_active() > 0 && !ui->loading &&
+        strcmp(ui->current_url.full, "gemini://downloads/") == 0 &&
+        SDL_GetTicks() - ui->downloads_shown >= DOWNLOADS_REFRESH_MS) {
+        ui_show_downloads(ui);
+    }
 }
 
 void ui_draw(UI *ui) {
     if (!ui || !ui->renderer) return;
 
-    if (ui->loading) {
+    /* Nothing to show yet - keep the full-screen indicator for the first page */
+    if (ui->loading && !ui->document) {
         render_loading(ui->renderer, ui->status_message);
         render_flip(ui->renderer);
         return;
     }
 
     if (ui->document) {
+        render_layout(ui->renderer, ui->document);
         render_document(ui->renderer, ui->document, ui->scroll_y);
+        ui->prefetch_dirty = true;
 
         /* Calculate max scroll */
         ui->max_scroll = ui->renderer->content_height - (ui->screen_height - MARGIN_TOP);
         if (ui->max_scroll < 0) ui->max_scroll = 0;
+
+        /* A new page may have replaced the one the outline was for */
+        if (ui->outline_open && ui->document->num_headings == 0) ui->outline_open = false;
+        if (ui->outline_open) {
+            int max = render_outline_max_scroll(ui->renderer, ui->document);
+            if (ui->outline_scroll > max) ui->outline_scroll = max;
+            render_outline(ui->renderer, ui->document, ui_current_heading(ui), ui->outline_scroll);
+        }
     }
     else {
         render_clear(ui->renderer);
@@ -731,6 +1619,15 @@ void ui_run(UI *ui) {
     }
     log_msg("Gemini initialized");
 
+    if (!disk_cache_init(DISK_CACHE_DIR)) {
+        log_msg("Disk cache unavailable, pages are cached in memory only");
+    }
+    cache_init(CACHE_MAX_BYTES, CACHE_FRESH_MS);
+    redirect_init(REDIRECT_FILE);
+    if (!download_init(DOWNLOAD_DIR)) {
+        log_msg("Download directory %s unavailable", DOWNLOAD_DIR);
+    }
+
     /* Navigate to start page */
     log_msg("Navigating to start page: %s", DEFAULT_URL);
     ui_navigate(ui, DEFAULT_URL);
@@ -774,5 +1671,11 @@ void ui_run(UI *ui) {
         }
     }
 
+    ui_stop_loading(ui);
+    prefetch_clear();
+    cache_cleanup();
+    disk_cache_cleanup();
+    redirect_cleanup();
     gemini_cleanup();
+    download_cleanup();
 }
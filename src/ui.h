@@ -7,6 +7,8 @@
 #include "render.h"
 #include "history.h"
 #include "document.h"
+#include "gemini.h"
+#include "redirect.h"
 #include "url.h"
 
 /* Bookmarks */
@@ -32,11 +34,30 @@ typedef struct {
     bool loading;
     char status_message[256];
 
+    /* In-flight navigation (NULL when idle) */
+    GeminiRequest *pending;
+    bool pending_is_back;       /* Restore pending_scroll instead of pushing history */
+    int pending_scroll;
+    int redirect_count;         /* Hops followed so far */
+    char redirect_chain[REDIRECT_MAX_CHAIN][MAX_URL_LENGTH];   /* ...and where from */
+    Url unreachable;            /* Host that just failed fast - opening it again retries */
+
+    /* Prefetching */
+    Uint32 last_input;          /* SDL_GetTicks() of the last touch or key */
+    bool prefetch_dirty;        /* Visible links changed since the last pass */
+
+    /* Downloads */
+    Uint32 downloads_shown;     /* SDL_GetTicks() the downloads page was built */
+
     /* Scrolling */
     int scroll_y;
     int max_scroll;
     float scroll_velocity;
 
+    /* Outline overlay */
+    bool outline_open;
+    int outline_scroll;
+
     /* Touch tracking */
     bool touch_active;
     int touch_start_x;
@@ -75,6 +96,9 @@ void ui_run(UI *ui);
 /* Navigate to a URL */
 void ui_navigate(UI *ui, const char *url_str);
 
+/* Cancel the in-flight navigation, if any */
+void ui_stop_loading(UI *ui);
+
 /* Handle SDL event. Returns false if app should quit. */
 bool ui_handle_event(UI *ui, SDL_Event *event);
 
@@ -97,4 +121,13 @@ void ui_add_bookmark(UI *ui);
 void ui_delete_bookmark(UI *ui, int index);
 void ui_show_bookmarks(UI *ui);
 
+/* Show the gemini://stats/ page (cache and network counters) */
+void ui_show_stats(UI *ui);
+
+/* Show the gemini://stats/hosts/ page (latency percentiles and results per host) */
+void ui_show_host_stats(UI *ui);
+
+/* Show the gemini://downloads/ page (files being saved, and their progress) */
+void ui_show_downloads(UI *ui);
+
 #endif /* PALMINI_UI_H */
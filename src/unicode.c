@@ -1,5 +1,6 @@
 /* Gemini Browser - Unicode fallback for webOS (Unicode 6.0) */
 #include "unicode.h"
+#include "textscan.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -454,8 +455,8 @@ static const char *find_fallback(uint32_t codepoint) {
     return NULL;
 }
 
-/* Decode UTF-8 sequence, return codepoint and advance pointer */
-static uint32_t utf8_decode(const char **p) {
+/* Decode UTF-8 sequence ending before end, return codepoint and advance pointer */
+static uint32_t utf8_decode(const char **p, const char *end) {
     const unsigned char *s = (const unsigned char *)*p;
     uint32_t cp;
     int len;
@@ -478,6 +479,12 @@ static uint32_t utf8_decode(const char **p) {
         return 0xFFFD;  /* Replacement character */
     }
 
+    if (len > end - *p) {
+        /* Truncated sequence */
+        *p += 1;
+        return 0xFFFD;
+    }
+
     for (int i = 1; i < len; i++) {
         if ((s[i] & 0xC0) != 0x80) {
             /* Invalid continuation byte */
@@ -541,111 +548,83 @@ static int needs_fallback(uint32_t cp) {
     return 0;
 }
 
-char *unicode_sanitize(const char *text) {
-    if (!text) return NULL;
+/* Generic placeholder for a symbol with no entry in the table */
+static const char *generic_fallback(uint32_t cp) {
+    if (cp >= 0x1F600 && cp <= 0x1F64F) return ":)";   /* Emoticons */
+    if (cp >= 0x1F900 && cp <= 0x1F9FF) return ":)";   /* Supplemental emoticons */
+    return "*";     /* Weather, plants, animals, objects, transport, ... */
+}
 
-    /* Allocate output buffer - may need more space for expansions */
-    size_t len = strlen(text);
-    size_t out_capacity = len * 2 + 1;  /* Worst case: every char expands */
-    char *out = malloc(out_capacity);
-    if (!out) return NULL;
+/* Copy n bytes to out at pos, as far as they fit in out_size - 1 */
+static void emit(char *out, size_t out_size, size_t pos, const char *s, size_t n) {
+    if (pos + 1 >= out_size) return;
+    if (n > out_size - 1 - pos) n = out_size - 1 - pos;
+    memcpy(out + pos, s, n);
+}
 
+size_t unicode_sanitize_to(char *out, size_t out_size, const char *text, size_t len) {
     const char *p = text;
-    char *q = out;
+    const char *end = text + len;
+    size_t pos = 0;
+
+    while (p < end) {
+        /* Runs of ASCII never need a fallback */
+        const char *run = p;
+        p = textscan_ascii_end(p, end);
+        if (p > run) {
+            emit(out, out_size, pos, run, p - run);
+            pos += p - run;
+            continue;
+        }
 
-    while (*p) {
         const char *start = p;
-        uint32_t cp = utf8_decode(&p);
+        uint32_t cp = utf8_decode(&p, end);
+        const char *replacement;
+        size_t n;
 
         if (cp == 0xFFFD) {
-            /* Invalid UTF-8, copy replacement char */
-            *q++ = '?';
-            continue;
+            /* Invalid UTF-8 */
+            replacement = "?";
         }
-
-        /* Check if this codepoint needs fallback */
-        const char *fallback = find_fallback(cp);
-        if (fallback) {
-            /* Use fallback string */
-            size_t fb_len = strlen(fallback);
-            /* Check buffer space */
-            size_t used = q - out;
-            if (used + fb_len + 1 > out_capacity) {
-                out_capacity = out_capacity * 2 + fb_len;
-                char *new_out = realloc(out, out_capacity);
-                if (!new_out) {
-                    free(out);
-                    return NULL;
-                }
-                q = new_out + used;
-                out = new_out;
-            }
-            memcpy(q, fallback, fb_len);
-            q += fb_len;
-        } else if (needs_fallback(cp) && !fallback) {
+        else if ((replacement = find_fallback(cp)) == NULL && needs_fallback(cp)) {
             /* Unknown emoji/symbol without specific fallback */
-            /* Use generic placeholder based on range */
-            const char *generic;
-            if (cp >= 0x1F600 && cp <= 0x1F64F) {
-                generic = ":)";  /* Emoticons */
-            } else if (cp >= 0x1F300 && cp <= 0x1F33F) {
-                generic = "*";   /* Weather/nature symbols */
-            } else if (cp >= 0x1F340 && cp <= 0x1F37F) {
-                generic = "*";   /* Plants and food */
-            } else if (cp >= 0x1F380 && cp <= 0x1F3FF) {
-                generic = "*";   /* Celebrations/objects */
-            } else if (cp >= 0x1F400 && cp <= 0x1F43F) {
-                generic = "*";   /* Animals */
-            } else if (cp >= 0x1F440 && cp <= 0x1F4FF) {
-                generic = "*";   /* Body parts and objects */
-            } else if (cp >= 0x1F500 && cp <= 0x1F5FF) {
-                generic = "*";   /* Symbols */
-            } else if (cp >= 0x1F680 && cp <= 0x1F6FF) {
-                generic = "*";   /* Transport/maps */
-            } else if (cp >= 0x1F900 && cp <= 0x1F9FF) {
-                generic = ":)";  /* Supplemental emoticons */
-            } else if (cp >= 0x1FA00 && cp <= 0x1FAFF) {
-                generic = "*";   /* Extended symbols */
-            } else {
-                generic = "*";   /* Other symbols */
-            }
-            size_t g_len = strlen(generic);
-            size_t used = q - out;
-            if (used + g_len + 1 > out_capacity) {
-                out_capacity = out_capacity * 2 + g_len;
-                char *new_out = realloc(out, out_capacity);
-                if (!new_out) {
-                    free(out);
-                    return NULL;
-                }
-                q = new_out + used;
-                out = new_out;
-            }
-            memcpy(q, generic, g_len);
-            q += g_len;
-        } else {
+            replacement = generic_fallback(cp);
+        }
+
+        if (replacement) {
+            n = strlen(replacement);
+        }
+        else {
             /* Keep original character */
-            size_t char_len = p - start;
-            size_t used = q - out;
-            if (used + char_len + 1 > out_capacity) {
-                out_capacity = out_capacity * 2 + char_len;
-                char *new_out = realloc(out, out_capacity);
-                if (!new_out) {
-                    free(out);
-                    return NULL;
-                }
-                q = new_out + used;
-                out = new_out;
-            }
-            memcpy(q, start, char_len);
-            q += char_len;
+            replacement = start;
+            n = p - start;
         }
+        emit(out, out_size, pos, replacement, n);
+        pos += n;
     }
 
-    *q = '\0';
+    if (out_size > 0) out[pos < out_size ? pos : out_size - 1] = '\0';
+    return pos;
+}
+
+char *unicode_sanitize(const char *text) {
+    if (!text) return NULL;
 
-    /* Shrink to fit */
-    size_t final_len = q - out + 1;
-    char *final = realloc(out, final_len);
-    return final ? final : out;
+    /* Most text comes out the same size, so one pass usually does */
+    size_t len = strlen(text);
+    size_t out_capacity = len + 1;
+    char *out = malloc(out_capacity);
+    if (!out) return NULL;
+
+    size_t out_len = unicode_sanitize_to(out, out_capacity, text, len);
+    if (out_len >= out_capacity) {
+        char *bigger = realloc(out, out_len + 1);
+        if (!bigger) {
+            free(out);
+            return NULL;
+        }
+        out = bigger;
+        unicode_sanitize_to(out, out_len + 1, text, len);
+    }
+    return out;
 }
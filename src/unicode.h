@@ -2,6 +2,8 @@
 #ifndef PALMINI_UNICODE_H
 #define PALMINI_UNICODE_H
 
+#include <stddef.h>
+
 /*
  * Sanitize UTF-8 text by replacing Unicode 7.0+ characters
  * with Unicode 6.0 compatible fallbacks or ASCII approximations.
@@ -11,4 +13,12 @@
  */
 char *unicode_sanitize(const char *text);
 
+/*
+ * Sanitize len bytes of text into out, which has room for out_size
+ * bytes. The result is NUL-terminated if out_size is not 0. Returns the
+ * length of the whole sanitized text: if that is out_size or more, it
+ * was cut short, as with snprintf().
+ */
+size_t unicode_sanitize_to(char *out, size_t out_size, const char *text, size_t len);
+
 #endif /* PALMINI_UNICODE_H */
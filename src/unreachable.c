@@ -0,0 +1,155 @@
+/* Gemini Browser - Negative cache of unreachable hosts */
+#include "unreachable.h"
+#include <string.h>
+#include <SDL_mutex.h>
+
+typedef struct {
+    char host[256];
+    int port;
+    UnreachableReason reason;
+    int failures;               /* In a row */
+    Uint32 until;               /* SDL_GetTicks() the entry expires */
+} UnreachableEntry;
+
+static UnreachableEntry entries[UNREACHABLE_MAX];
+static int num_entries = 0;
+static UnreachableStats stats;
+static SDL_mutex *lock = NULL;
+
+static bool expired(const UnreachableEntry *e, Uint32 now) {
+    return (Sint32)(now - e->until) >= 0;
+}
+
+static void remove_entry(int index) {
+    entries[index] = entries[num_entries - 1];
+    num_entries--;
+}
+
+/* Index of host:port, expired or not. Expired entries keep their
+ * failure count, so a host that keeps failing is marked for longer each
+ * time until it is reached again. */
+static int find_entry(const char *host, int port) {
+    for (int i = 0; i < num_entries; i++) {
+        if (entries[i].port == port && strcmp(entries[i].host, host) == 0) return i;
+    }
+    return -1;
+}
+
+bool unreachable_init(void) {
+    if (!lock) {
+        lock = SDL_CreateMutex();
+        if (!lock) return false;
+    }
+
+    num_entries = 0;
+    memset(&stats, 0, sizeof(stats));
+    return true;
+}
+
+void unreachable_cleanup(void) {
+    if (lock) SDL_DestroyMutex(lock);
+    lock = NULL;
+    num_entries = 0;
+}
+
+void unreachable_mark(const char *host, int port, UnreachableReason reason) {
+    if (!lock || !host || !host[0]) return;
+
+    Uint32 now = SDL_GetTicks();
+    SDL_LockMutex(lock);
+    int index = find_entry(host, port);
+    if (index < 0) {
+        if (num_entries < UNREACHABLE_MAX) {
+            index = num_entries++;
+        }
+        else {
+            /* Replace the entry closest to expiring */
+            index = 0;
+            for (int i = 1; i < num_entries; i++) {
+                if ((Sint32)(entries[i].until - entries[index].until) < 0) index = i;
+            }
+        }
+        memset(&entries[index], 0, sizeof(entries[index]));
+        strncpy(entries[index].host, host, sizeof(entries[index].host) - 1);
+        entries[index].port = port;
+    }
+
+    UnreachableEntry *e = &entries[index];
+    Uint32 ttl = UNREACHABLE_TTL_MS;
+    for (int i = 0; i < e->failures && ttl < UNREACHABLE_MAX_TTL_MS; i++) {
+        ttl *= 2;
+    }
+    if (ttl > UNREACHABLE_MAX_TTL_MS) ttl = UNREACHABLE_MAX_TTL_MS;
+
+    e->reason = reason;
+    e->failures++;
+    e->until = now + ttl;
+    stats.marked++;
+    SDL_UnlockMutex(lock);
+}
+
+void unreachable_clear(const char *host, int port) {
+    if (!lock || !host) return;
+
+    SDL_LockMutex(lock);
+    int index = find_entry(host, port);
+    if (index >= 0) remove_entry(index);
+    SDL_UnlockMutex(lock);
+}
+
+bool unreachable_check(const char *host, int port, UnreachableReason *reason,
+                       Uint32 *remaining_ms) {
+    if (!lock || !host) return false;
+
+    Uint32 now = SDL_GetTicks();
+    SDL_LockMutex(lock);
+    int index = find_entry(host, port);
+    bool marked = index >= 0 && !expired(&entries[index], now);
+    if (marked) {
+        if (reason) *reason = entries[index].reason;
+        if (remaining_ms) *remaining_ms = entries[index].until - now;
+        stats.hits++;
+    }
+    SDL_UnlockMutex(lock);
+    return marked;
+}
+
+void unreachable_override(const char *host, int port) {
+    if (!lock || !host) return;
+
+    Uint32 now = SDL_GetTicks();
+    SDL_LockMutex(lock);
+    int index = find_entry(host, port);
+    if (index >= 0 && !expired(&entries[index], now)) {
+        /* Keep the failure count, so failing again marks it for longer */
+        entries[index].until = now;
+        stats.overrides++;
+    }
+    SDL_UnlockMutex(lock);
+}
+
+const char *unreachable_reason_name(UnreachableReason reason) {
+    switch (reason) {
+        case UNREACHABLE_DNS:       return "name did not resolve";
+        case UNREACHABLE_REFUSED:   return "connection refused";
+        case UNREACHABLE_TIMEOUT:   return "timed out";
+        default:                    return "unknown";
+    }
+}
+
+void unreachable_stats(UnreachableStats *out) {
+    if (!out) return;
+    if (!lock) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    Uint32 now = SDL_GetTicks();
+    SDL_LockMutex(lock);
+    *out = stats;
+    out->entries = 0;
+    for (int i = 0; i < num_entries; i++) {
+        if (!expired(&entries[i], now)) out->entries++;
+    }
+    SDL_UnlockMutex(lock);
+}
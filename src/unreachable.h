@@ -0,0 +1,55 @@
+/* Gemini Browser - Negative cache of unreachable hosts */
+#ifndef PALMINI_UNREACHABLE_H
+#define PALMINI_UNREACHABLE_H
+
+#include <stdbool.h>
+#include <SDL.h>
+
+#define UNREACHABLE_MAX         32
+#define UNREACHABLE_TTL_MS      (30 * 1000)     /* After the first failure */
+#define UNREACHABLE_MAX_TTL_MS  (5 * 60 * 1000) /* Doubled per failure up to this */
+
+/* Why a host was marked */
+typedef enum {
+    UNREACHABLE_DNS,            /* Name didn't resolve */
+    UNREACHABLE_REFUSED,        /* Every address refused or failed */
+    UNREACHABLE_TIMEOUT         /* Lookup or connect ran out of time */
+} UnreachableReason;
+
+typedef struct {
+    unsigned long marked;       /* Failures recorded */
+    unsigned long hits;         /* Attempts that failed fast or were skipped */
+    unsigned long overrides;    /* Entries dropped by the user retrying */
+    int entries;                /* Hosts marked right now */
+} UnreachableStats;
+
+/* Hosts (by name and port) that recently failed to resolve or connect.
+ * Further attempts fail straight away until the entry expires, instead
+ * of waiting out the connect timeout again. Failures are recorded on the
+ * fetch engine thread; the rest may be called from any thread. */
+
+bool unreachable_init(void);
+void unreachable_cleanup(void);
+
+/* Record a failure to reach host:port. Repeated failures keep it marked
+ * for longer. */
+void unreachable_mark(const char *host, int port, UnreachableReason reason);
+
+/* host:port was reached - drop any entry for it */
+void unreachable_clear(const char *host, int port);
+
+/* Whether host:port is marked. Fills *reason and *remaining_ms (time
+ * left before it is tried again) if they aren't NULL. */
+bool unreachable_check(const char *host, int port, UnreachableReason *reason,
+                       Uint32 *remaining_ms);
+
+/* The user wants to try host:port anyway */
+void unreachable_override(const char *host, int port);
+
+/* Short description of a reason, e.g. "connection refused" */
+const char *unreachable_reason_name(UnreachableReason reason);
+
+/* Get a snapshot of the counters */
+void unreachable_stats(UnreachableStats *stats);
+
+#endif /* PALMINI_UNREACHABLE_H */